@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// Scratch memory for temporaries inside multi-stage operators. Each thread
+// has its own arena, a stack of chunks that blocks are pushed onto and
+// popped off in LIFO order. Once the stack has drained, chunks added while
+// it grew are merged into one big enough for the high water mark, so a
+// repeated call settles into a single chunk and stops calling malloc.
+
+// Alignment of every block, enough for any vector load and a cache line.
+#define ARENA_ALIGN 64
+
+// Smallest chunk the arena asks malloc for.
+#define ARENA_MIN_CHUNK (1 << 20)
+
+typedef struct arena_chunk{
+    struct arena_chunk *prev;
+    size_t size;
+    size_t used;
+    char *data;
+} arena_chunk;
+
+static __thread arena_chunk *arena_top = 0;
+// Bytes pushed right now across all chunks, and the most ever pushed.
+static __thread size_t arena_live = 0;
+static __thread size_t arena_peak = 0;
+static __thread size_t arena_mallocs = 0;
+
+static arena_chunk *new_chunk(size_t size, arena_chunk *prev)
+{
+    arena_chunk *c = malloc(sizeof(arena_chunk));
+    c->prev = prev;
+    c->size = size;
+    c->used = 0;
+    c->data = aligned_alloc(ARENA_ALIGN, size);
+    ++arena_mallocs;
+    return c;
+}
+
+static void free_chunk(arena_chunk *c)
+{
+    free(c->data);
+    free(c);
+}
+
+// Reserves scratch memory on the calling thread's arena. The block stays
+// valid until it, or a block pushed before it, is popped. Contents are
+// not cleared. Pushing 0 bytes gives a mark to pop back to later.
+// size_t bytes: size of the block.
+// returns: 64 byte aligned block.
+void *uw_arena_push(size_t bytes)
+{
+    bytes = (bytes + ARENA_ALIGN - 1)/ARENA_ALIGN*ARENA_ALIGN;
+    if (bytes == 0) bytes = ARENA_ALIGN;
+    if (!arena_top || arena_top->used + bytes > arena_top->size) {
+        size_t size = arena_top ? 2*arena_top->size : ARENA_MIN_CHUNK;
+        if (size < bytes) size = bytes;
+        arena_top = new_chunk(size, arena_top);
+    }
+    void *p = arena_top->data + arena_top->used;
+    arena_top->used += bytes;
+    arena_live += bytes;
+    if (arena_live > arena_peak) arena_peak = arena_live;
+    return p;
+}
+
+// Pops a block and every block pushed after it.
+// void *p: block returned by uw_arena_push on this thread.
+void uw_arena_pop(void *p)
+{
+    char *q = p;
+    while (arena_top && !(q >= arena_top->data && q < arena_top->data + arena_top->size)) {
+        arena_chunk *c = arena_top;
+        arena_live -= c->used;
+        arena_top = c->prev;
+        free_chunk(c);
+    }
+    assert(arena_top);
+    size_t used = q - arena_top->data;
+    arena_live -= arena_top->used - used;
+    arena_top->used = used;
+
+    // Fully drained: make sure the next round fits in one chunk.
+    if (arena_live == 0 && (arena_top->prev || arena_top->size < arena_peak)) {
+        size_t size = arena_peak;
+        while (arena_top) {
+            arena_chunk *c = arena_top;
+            arena_top = c->prev;
+            free_chunk(c);
+        }
+        arena_top = new_chunk(size, 0);
+    }
+}
+
+// Makes a zeroed image whose pixels live on the calling thread's arena.
+// Release it with uw_arena_pop(im.data), never free_image.
+image uw_arena_image(int w, int h, int c)
+{
+    image im;
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.data = uw_arena_push((size_t)w*h*c*sizeof(float));
+    memset(im.data, 0, (size_t)w*h*c*sizeof(float));
+    return im;
+}
+
+// Frees all of the calling thread's arena memory. Nothing may be pushed.
+void uw_arena_release()
+{
+    assert(arena_live == 0);
+    while (arena_top) {
+        arena_chunk *c = arena_top;
+        arena_top = c->prev;
+        free_chunk(c);
+    }
+    arena_peak = 0;
+}
+
+// returns: how many chunks the calling thread's arena has allocated so far.
+size_t uw_arena_allocations()
+{
+    return arena_mallocs;
+}
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "image.h"
+#include "test.h"
+#include "stencil.h"
+
+#define BENCH_RUNS 5
+
+double what_time_is_it_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+// Average time of a convolution over BENCH_RUNS runs.
+// returns: milliseconds per call.
+double time_convolve(image im, image f, int preserve)
+{
+    int i;
+    double start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        image out = convolve_image(im, f, preserve);
+        free_image(out);
+    }
+    return (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+}
+
+// Compares every 3x3 stencil implementation against the generic
+// convolution path on the 3x3 filters.
+void bench_stencil(image im)
+{
+    struct { const char *name; image f; int preserve; } filters[] = {
+        {"highpass", make_highpass_filter(), 0},
+        {"sharpen", make_sharpen_filter(), 1},
+        {"emboss", make_emboss_filter(), 1},
+        {"gx", make_gx_filter(), 0},
+        {"gy", make_gy_filter(), 0},
+    };
+    int n = sizeof(filters)/sizeof(filters[0]);
+    stencil_impl saved = get_stencil_impl();
+    stencil_impl best = best_stencil_impl();
+    int i, s;
+
+    printf("3x3 stencil, %d x %d x %d image\n", im.w, im.h, im.c);
+    for(i = 0; i < n; ++i){
+        double generic = 0;
+        for(s = STENCIL_NONE; s <= best; ++s){
+            set_stencil_impl(s);
+            double ms = time_convolve(im, filters[i].f, filters[i].preserve);
+            if(s == STENCIL_NONE) generic = ms;
+            printf("  %-10s %-8s %8.2f ms  %5.2fx\n", filters[i].name,
+                    stencil_impl_name(s), ms, generic / ms);
+        }
+        free_image(filters[i].f);
+    }
+    set_stencil_impl(saved);
+}
+
+// Fused Sobel against the two convolutions it replaces.
+void bench_sobel(image im)
+{
+    int i;
+    image gx = make_gx_filter();
+    image gy = make_gy_filter();
+    double start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        image a = convolve_image(im, gx, 0);
+        image b = convolve_image(im, gy, 0);
+        free_image(a);
+        free_image(b);
+    }
+    double conv = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        image *s = sobel_image(im);
+        free_image(s[0]);
+        free_image(s[1]);
+        free(s);
+    }
+    double fused = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        image m = sobel_magnitude(im);
+        free_image(m);
+    }
+    double magnitude = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("sobel, %d x %d x %d image\n", im.w, im.h, im.c);
+    printf("  gx + gy convolutions   %8.2f ms\n", conv);
+    printf("  sobel_image            %8.2f ms\n", fused);
+    printf("  sobel_magnitude        %8.2f ms\n", magnitude);
+    free_image(gx);
+    free_image(gy);
+}
+
+// FIR against recursive Gaussian smoothing as sigma grows.
+void bench_smooth(image im)
+{
+    float sigmas[] = {1, 2, 4, 8, 16, 32};
+    int n = sizeof(sigmas)/sizeof(sigmas[0]);
+    int i, j, m;
+    printf("smooth, %d x %d x %d image\n", im.w, im.h, im.c);
+    for(i = 0; i < n; ++i){
+        double ms[2];
+        for(m = 0; m < 2; ++m){
+            double start = what_time_is_it_now();
+            for(j = 0; j < BENCH_RUNS; ++j){
+                image s = smooth_image_mode(im, sigmas[i], m ? SMOOTH_IIR : SMOOTH_FIR);
+                free_image(s);
+            }
+            ms[m] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+        }
+        printf("  sigma %5.1f  fir %8.2f ms  iir %8.2f ms\n", sigmas[i], ms[0], ms[1]);
+    }
+}
+
+// Vectorized color space round trip against the pixel at a time one.
+void bench_hsv(image im)
+{
+    int i;
+    image c = copy_image(im);
+    double start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        rgb_to_hsv_reference(c);
+        hsv_to_rgb_reference(c);
+    }
+    double ref = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    for(i = 0; i < BENCH_RUNS; ++i){
+        rgb_to_hsv(c);
+        hsv_to_rgb(c);
+    }
+    double fast = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("rgb -> hsv -> rgb, %d x %d image\n", im.w, im.h);
+    printf("  pixel at a time        %8.2f ms\n", ref);
+    printf("  vectorized             %8.2f ms  %5.2fx\n", fast, ref / fast);
+    free_image(c);
+}
+
+// Float against half precision storage for the bandwidth bound passes.
+void bench_f16(image im)
+{
+    float sigmas[] = {2, 8};
+    int i, j;
+    image_f16 h = image_to_f16(im);
+    printf("float vs half storage, %d x %d x %d image\n", im.w, im.h, im.c);
+    for(i = 0; i < 2; ++i){
+        double start = what_time_is_it_now();
+        for(j = 0; j < BENCH_RUNS; ++j){
+            image s = smooth_image(im, sigmas[i]);
+            free_image(s);
+        }
+        double ms32 = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+        start = what_time_is_it_now();
+        for(j = 0; j < BENCH_RUNS; ++j){
+            image_f16 s = smooth_image_f16(h, sigmas[i]);
+            free_image_f16(s);
+        }
+        double ms16 = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+        printf("  smooth sigma %4.1f  float %8.2f ms  half %8.2f ms\n", sigmas[i], ms32, ms16);
+    }
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        image r = bilinear_resize(im, im.w*3/2, im.h*3/2);
+        free_image(r);
+    }
+    double ms32 = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        image_f16 r = bilinear_resize_f16(h, im.w*3/2, im.h*3/2);
+        free_image_f16(r);
+    }
+    double ms16 = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    printf("  bilinear x1.5      float %8.2f ms  half %8.2f ms\n", ms32, ms16);
+    free_image_f16(h);
+}
+
+// A six step color correction as separate passes against one fused pass.
+void bench_pointwise(image im)
+{
+    int j;
+    image a = copy_image(im);
+    image sharp = copy_image(im);
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        shift_image(a, 0, .01);
+        scale_image(a, 1, 1.01);
+        add_image_into(a, sharp, a);
+        shift_image(a, 2, -.01);
+        sub_image_into(a, sharp, a);
+        clamp_image(a);
+    }
+    double separate = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    pointwise_expr e = pointwise_begin();
+    pointwise_shift(&e, 0, .01);
+    pointwise_scale(&e, 1, 1.01);
+    pointwise_add(&e, sharp);
+    pointwise_shift(&e, 2, -.01);
+    pointwise_sub(&e, sharp);
+    pointwise_clamp(&e);
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) pointwise_apply(&e, a);
+    double fused = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("six step pointwise chain, %d x %d x %d image\n", im.w, im.h, im.c);
+    printf("  separate passes        %8.2f ms\n", separate);
+    printf("  fused                  %8.2f ms  %5.2fx\n", fused, separate / fused);
+    free_image(a);
+    free_image(sharp);
+}
+
+// The saturation boost of the dog_saturated example, as a color transform.
+static void saturate_transform(image im, void *arg)
+{
+    rgb_to_hsv(im);
+    scale_image(im, 1, *(float *)arg);
+    clamp_image(im);
+    hsv_to_rgb(im);
+}
+
+// A saturation boost run as hsv operations against a baked 33^3 table.
+void bench_color_lut(image im)
+{
+    int j;
+    float factor = 2;
+    image a = copy_image(im);
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) saturate_transform(a, &factor);
+    double chain = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    color_lut lut = make_color_lut(33, saturate_transform, &factor);
+    double bake = (what_time_is_it_now() - start) * 1000;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) apply_color_lut(a, lut);
+    double table = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("saturation boost, %d x %d image\n", im.w, im.h);
+    printf("  hsv chain              %8.2f ms\n", chain);
+    printf("  3d lut                 %8.2f ms  %5.2fx, %.2f ms to bake\n", table, chain / table, bake);
+    free_color_lut(lut);
+    free_image(a);
+}
+
+void bench_srgb(image im)
+{
+    int i, j, n = im.w*im.h*im.c;
+    unsigned char *out = malloc(n);
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        for(i = 0; i < n; ++i){
+            out[i] = roundf(255*linear_to_srgb(MIN(MAX(im.data[i], 0), 1)));
+        }
+    }
+    double formula = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) linear_to_srgb8_row(im.data, out, n);
+    double table = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("sRGB encode, %d x %d image\n", im.w, im.h);
+    printf("  pow per value          %8.2f ms\n", formula);
+    printf("  tables                 %8.2f ms  %5.2fx\n", table, formula / table);
+    free(out);
+}
+
+void bench_resample(image im)
+{
+    int j, w = im.w/7, h = im.h/7;
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        image s = smooth_image(im, 3.5);
+        image r = bilinear_resize(s, w, h);
+        free_image(s); free_image(r);
+    }
+    double blur = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    printf("shrink 7x, %d x %d image\n", im.w, im.h);
+    printf("  smooth + bilinear      %8.2f ms\n", blur);
+
+    const char *names[] = {"area", "bicubic", "lanczos3"};
+    resample_filter filters[] = {RESAMPLE_AREA, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3};
+    for(int f = 0; f < 3; ++f){
+        start = what_time_is_it_now();
+        for(j = 0; j < BENCH_RUNS; ++j){
+            image r = resample_image(im, w, h, filters[f]);
+            free_image(r);
+        }
+        double ms = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+        printf("  %-22s %8.2f ms  %5.2fx\n", names[f], ms, blur / ms);
+    }
+}
+
+void bench_pyramid(image im)
+{
+    int i, j, levels = 5;
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        image cur = copy_image(im);
+        for(i = 1; i < levels; ++i){
+            image s = smooth_image(cur, 1);
+            image next = bilinear_resize(s, (cur.w + 1)/2, (cur.h + 1)/2);
+            free_image(s); free_image(cur);
+            cur = next;
+        }
+        free_image(cur);
+    }
+    double chain = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j){
+        pyramid p = make_pyramid(im, levels);
+        free_pyramid(p);
+    }
+    double pyr = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    pyramid p = make_pyramid(im, levels);
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) rebuild_pyramid(p, 0);
+    double rebuild = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    free_pyramid(p);
+
+    printf("%d level pyramid, %d x %d image\n", levels, im.w, im.h);
+    printf("  smooth + bilinear      %8.2f ms\n", chain);
+    printf("  make_pyramid           %8.2f ms  %5.2fx\n", pyr, chain / pyr);
+    printf("  rebuild_pyramid        %8.2f ms  %5.2fx\n", rebuild, chain / rebuild);
+}
+
+void bench_remap(image im)
+{
+    int i, j, k, r;
+    matrix H = make_translation_homography(40, -25);
+    H.data[0][1] = .05;
+    H.data[1][0] = -.05;
+    H.data[2][0] = .00002;
+    image out = make_image(im.w, im.h, im.c);
+
+    double start = what_time_is_it_now();
+    for(k = 0; k < im.c; ++k){
+        #pragma omp parallel for private(i) schedule(static)
+        for(j = 0; j < im.h; ++j){
+            for(i = 0; i < im.w; ++i){
+                double **h = H.data;
+                double z = h[2][0]*i + h[2][1]*j + h[2][2];
+                float x = (h[0][0]*i + h[0][1]*j + h[0][2])/z;
+                float y = (h[1][0]*i + h[1][1]*j + h[1][2])/z;
+                if(x >= 0 && x < im.w && y >= 0 && y < im.h){
+                    set_pixel(out, i, j, k, bilinear_interpolate(im, x, y, k));
+                }
+            }
+        }
+    }
+    double naive = (what_time_is_it_now() - start) * 1000;
+
+    warp gen = homography_warp(H, im.w, im.h, 0, 0);
+    start = what_time_is_it_now();
+    for(r = 0; r < BENCH_RUNS; ++r) remap_image_into(im, gen, out);
+    double generated = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    warp baked = bake_warp(gen);
+    start = what_time_is_it_now();
+    for(r = 0; r < BENCH_RUNS; ++r) remap_image_into(im, baked, out);
+    double stored = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("homography warp, %d x %d image\n", im.w, im.h);
+    printf("  per pixel interpolate  %8.2f ms\n", naive);
+    printf("  generated rows         %8.2f ms  %5.2fx\n", generated, naive / generated);
+    printf("  baked map              %8.2f ms  %5.2fx\n", stored, naive / stored);
+    free_warp(baked);
+    free_matrix(H);
+    free_image(out);
+}
+
+void bench_resize2x(image im)
+{
+    int j;
+    image half = make_image(im.w/2, im.h/2, im.c);
+    image twice = make_image(im.w*2, im.h*2, im.c);
+    image_u8 u = image_to_u8(im);
+    double ms[4];
+    double start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) resample_image_into(im, half, RESAMPLE_AREA);
+    ms[0] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) downsample2x_into(im, half);
+    ms[1] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) resample_image_into(im, twice, RESAMPLE_BILINEAR);
+    ms[2] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) upsample2x_into(im, twice);
+    ms[3] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    double ms8[2];
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) free_image_u8(downsample2x_u8(u));
+    ms8[0] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+    start = what_time_is_it_now();
+    for(j = 0; j < BENCH_RUNS; ++j) free_image_u8(upsample2x_u8(u));
+    ms8[1] = (what_time_is_it_now() - start) * 1000 / BENCH_RUNS;
+
+    printf("2x resize, %d x %d image\n", im.w, im.h);
+    printf("  half    separable %8.2f ms  2x kernel %8.2f ms  %5.2fx  u8 %8.2f ms\n",
+            ms[0], ms[1], ms[0] / ms[1], ms8[0]);
+    printf("  double  separable %8.2f ms  2x kernel %8.2f ms  %5.2fx  u8 %8.2f ms\n",
+            ms[2], ms[3], ms[2] / ms[3], ms8[1]);
+    free_image(half); free_image(twice); free_image_u8(u);
+}
+
+void run_benchmarks()
+{
+    image dog = load_image("data/dog.jpg");
+    image im = bilinear_resize(dog, 2048, 1536);
+    printf("%d threads\n", uw_get_num_threads());
+    bench_stencil(im);
+    bench_sobel(im);
+    bench_smooth(im);
+    bench_hsv(im);
+    bench_f16(im);
+    bench_pointwise(im);
+    bench_color_lut(im);
+    bench_srgb(im);
+    bench_resample(im);
+    bench_pyramid(im);
+    bench_remap(im);
+    bench_resize2x(im);
+    free_image(dog);
+    free_image(im);
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// 3D color lookup tables. Any RGB to RGB transform built from image
+// operations is sampled once on an n x n x n grid over the unit cube and
+// then applied to every pixel by trilinear interpolation between the
+// eight grid points around it, a fixed and branch free cost whatever the
+// transform was.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LUT_X86
+#endif
+
+// Samples a color transform on an n x n x n grid. The grid is laid out as
+// an image so the transform runs on it exactly as it would on a photo.
+// int n: grid points per axis, at least 2. 33 is the usual choice.
+// color_transform f: transform, changes the first three channels of an
+//                    image in place, e.g. rgb_to_hsv, scale_image on
+//                    saturation, hsv_to_rgb.
+// void *arg: passed through to f.
+// returns: the table, release with free_color_lut.
+color_lut make_color_lut(int n, color_transform f, void *arg)
+{
+    assert(n >= 2);
+    color_lut lut;
+    lut.n = n;
+    // Entry (r, g, b) is pixel x = r, y = b*n + g, so red varies fastest,
+    // then green, then blue, like a .cube file.
+    image grid = make_image(n, n*n, 3);
+    int size = n*n*n;
+    for (int b = 0; b < n; b++) {
+        for (int g = 0; g < n; g++) {
+            for (int r = 0; r < n; r++) {
+                int i = (b*n + g)*n + r;
+                grid.data[i] = (float)r/(n - 1);
+                grid.data[size + i] = (float)g/(n - 1);
+                grid.data[2*size + i] = (float)b/(n - 1);
+            }
+        }
+    }
+    if (f) f(grid, arg);
+    lut.data = grid.data;
+    return lut;
+}
+
+void free_color_lut(color_lut lut)
+{
+    free(lut.data);
+}
+
+// Interpolates n pixels of three planes through the table in place.
+// Inputs are clamped to [0, 1]. The eight corners are gathered with
+// computed indices and blended with selects only, so the loop vectorizes
+// into gathers where the target has them.
+static inline __attribute__((always_inline))
+void color_lut_span(const float *restrict t, int n,
+        float *restrict p0, float *restrict p1, float *restrict p2, int len)
+{
+    int size = n*n*n;
+    const float *t0 = t, *t1 = t + size, *t2 = t + 2*size;
+    float top = n - 1;
+    int n2 = n*n;
+    for (int x = 0; x < len; x++) {
+        float fr = MIN(MAX(p0[x], 0), 1)*top;
+        float fg = MIN(MAX(p1[x], 0), 1)*top;
+        float fb = MIN(MAX(p2[x], 0), 1)*top;
+        int ir = MIN((int)fr, n - 2);
+        int ig = MIN((int)fg, n - 2);
+        int ib = MIN((int)fb, n - 2);
+        float dr = fr - ir, dg = fg - ig, db = fb - ib;
+        int i = (ib*n + ig)*n + ir;
+
+        // Blend along red, then green, then blue.
+        #define LUT_LERP(tk, out) { \
+            float c00 = tk[i] + dr*(tk[i + 1] - tk[i]); \
+            float c10 = tk[i + n] + dr*(tk[i + n + 1] - tk[i + n]); \
+            float c01 = tk[i + n2] + dr*(tk[i + n2 + 1] - tk[i + n2]); \
+            float c11 = tk[i + n2 + n] + dr*(tk[i + n2 + n + 1] - tk[i + n2 + n]); \
+            float c0 = c00 + dg*(c10 - c00); \
+            float c1 = c01 + dg*(c11 - c01); \
+            out = c0 + db*(c1 - c0); }
+        float r, g, b;
+        LUT_LERP(t0, r)
+        LUT_LERP(t1, g)
+        LUT_LERP(t2, b)
+        #undef LUT_LERP
+        p0[x] = r;
+        p1[x] = g;
+        p2[x] = b;
+    }
+}
+
+typedef void (*lut_span_fn)(const float *t, int n, float *p0, float *p1, float *p2, int len);
+
+static void color_lut_generic(const float *t, int n, float *p0, float *p1, float *p2, int len)
+{
+    color_lut_span(t, n, p0, p1, p2, len);
+}
+
+#ifdef LUT_X86
+__attribute__((target("avx2")))
+static void color_lut_avx2(const float *t, int n, float *p0, float *p1, float *p2, int len)
+{
+    color_lut_span(t, n, p0, p1, p2, len);
+}
+#endif
+
+static lut_span_fn best_lut_span()
+{
+#ifdef LUT_X86
+    if (uw_cpu_has(UW_CPU_AVX2)) return color_lut_avx2;
+#endif
+    return color_lut_generic;
+}
+
+// Maps the first three channels of an image through a table in place.
+// image im: image to transform, at least 3 channels.
+// color_lut lut: table from make_color_lut or load_color_lut.
+void apply_color_lut(image im, color_lut lut)
+{
+    assert(im.c >= 3 && lut.n >= 2);
+    lut_span_fn span = best_lut_span();
+    int size = im.w*im.h;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < im.h; y++) {
+        float *p = im.data + y*im.w;
+        span(lut.data, lut.n, p, p + size, p + 2*size, im.w);
+    }
+}
+
+// Writes a table as a .cube file, the text format color grading tools
+// exchange 3D LUTs in. Values are written with enough digits to read back
+// exactly.
+// returns: 1 on success, 0 if the file can't be written.
+int save_color_lut(color_lut lut, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Cannot write color LUT \"%s\"\n", filename);
+        return 0;
+    }
+    int size = lut.n*lut.n*lut.n;
+    fprintf(fp, "LUT_3D_SIZE %d\n", lut.n);
+    for (int i = 0; i < size; i++) {
+        fprintf(fp, "%.9g %.9g %.9g\n", lut.data[i], lut.data[size + i], lut.data[2*size + i]);
+    }
+    int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+// Reads a 3D table from a .cube file. Comments, TITLE and the default
+// DOMAIN_MIN 0 0 0 / DOMAIN_MAX 1 1 1 lines are accepted; 1D tables and
+// other domains are not.
+// returns: the table, or one with n = 0 and no data if the file can't be
+//          read, release with free_color_lut.
+color_lut load_color_lut(const char *filename)
+{
+    color_lut lut = {0, 0};
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open color LUT \"%s\"\n", filename);
+        return lut;
+    }
+    char line[256];
+    int n = 0, count = 0, size = 0, bad = 0;
+    while (!bad && fgets(line, sizeof(line), fp)) {
+        char *s = line;
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s == '#' || *s == '\n' || *s == '\r' || *s == 0) continue;
+        float r, g, b;
+        if (!strncmp(s, "LUT_3D_SIZE", 11)) {
+            if (n || sscanf(s + 11, "%d", &n) != 1 || n < 2) bad = 1;
+            else {
+                size = n*n*n;
+                lut.data = malloc(3*(size_t)size*sizeof(float));
+            }
+        } else if (!strncmp(s, "DOMAIN_MIN", 10)) {
+            bad = sscanf(s + 10, "%f %f %f", &r, &g, &b) != 3 || r != 0 || g != 0 || b != 0;
+        } else if (!strncmp(s, "DOMAIN_MAX", 10)) {
+            bad = sscanf(s + 10, "%f %f %f", &r, &g, &b) != 3 || r != 1 || g != 1 || b != 1;
+        } else if (!strncmp(s, "TITLE", 5)) {
+            continue;
+        } else if (sscanf(s, "%f %f %f", &r, &g, &b) == 3) {
+            if (!n || count >= size) bad = 1;
+            else {
+                lut.data[count] = r;
+                lut.data[size + count] = g;
+                lut.data[2*size + count] = b;
+                count++;
+            }
+        } else {
+            bad = 1;
+        }
+    }
+    fclose(fp);
+    if (bad || !n || count != size) {
+        fprintf(stderr, "Bad color LUT \"%s\"\n", filename);
+        free(lut.data);
+        lut.data = 0;
+        return lut;
+    }
+    lut.n = n;
+    return lut;
+}
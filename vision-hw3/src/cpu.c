@@ -0,0 +1,36 @@
+#include <pthread.h>
+#include "image.h"
+
+// CPU feature checks for the kernels that pick an x86 implementation at
+// run time. The CPU is asked once, by whichever thread checks first, and
+// the answer is kept, so a check is cheap enough to make per row.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86
+#endif
+
+static int cpu_features = 0;
+static pthread_once_t cpu_features_once = PTHREAD_ONCE_INIT;
+
+static void probe_cpu()
+{
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    int f = 0;
+    if (__builtin_cpu_supports("sse2")) f |= UW_CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3")) f |= UW_CPU_SSSE3;
+    if (__builtin_cpu_supports("avx")) f |= UW_CPU_AVX;
+    if (__builtin_cpu_supports("avx2")) f |= UW_CPU_AVX2;
+    if (__builtin_cpu_supports("f16c")) f |= UW_CPU_F16C;
+    cpu_features = f;
+#endif
+}
+
+// Checks for CPU features. Always 0 off x86.
+// int features: UW_CPU_* flags or'ed together.
+// returns: 1 if the CPU has all of them.
+int uw_cpu_has(int features)
+{
+    pthread_once(&cpu_features_once, probe_cpu);
+    return (cpu_features & features) == features;
+}
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "fft.h"
+#include "image.h"
+
+// Smallest number >= n whose only prime factors are 2, 3 and 5.
+// int n: minimum transform length.
+// returns: a length the mixed radix FFT handles efficiently.
+int fft_good_size(int n)
+{
+    if (n <= 1) return 1;
+    for (;; ++n) {
+        int m = n;
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+        if (m == 1) return n;
+    }
+}
+
+// Builds the factorization and twiddle tables for a length n transform.
+// Radix 4 is preferred over two radix 2 passes since it halves the passes.
+fft_plan make_fft_plan(int n)
+{
+    fft_plan p;
+    p.n = n;
+    p.nfactors = 0;
+    int m = n;
+    int radix[] = {4, 2, 3, 5};
+    for (int i = 0; i < 4; i++) {
+        while (m % radix[i] == 0) {
+            p.factors[p.nfactors++] = radix[i];
+            m /= radix[i];
+        }
+    }
+    for (int f = 7; m > 1; f += 2) {
+        while (m % f == 0) {
+            p.factors[p.nfactors++] = f;
+            m /= f;
+        }
+    }
+    p.twiddle = calloc(2*n, sizeof(float complex));
+    p.itwiddle = p.twiddle + n;
+    for (int i = 0; i < n; i++) {
+        double a = -TWOPI * i / n;
+        p.twiddle[i] = cos(a) + I*sin(a);
+        p.itwiddle[i] = conjf(p.twiddle[i]);
+    }
+    return p;
+}
+
+void free_fft_plan(fft_plan p)
+{
+    free(p.twiddle);
+}
+
+// Decimation in time: transform the r interleaved subsequences of length
+// n/r into consecutive blocks of out, then combine them with radix r
+// butterflies in place.
+// const float complex *tw: N entry twiddle table for the direction wanted.
+// const float complex *in: input, read every istride elements.
+// float complex *out: n contiguous outputs.
+// int stride: N/n, the step through the twiddle table at this level.
+static void fft_rec(const fft_plan *p, const float complex *tw, const float complex *in,
+        int istride, float complex *out, int n, int stride, const int *factors)
+{
+    int r = factors[0];
+    int m = n / r;
+    if (m == 1) {
+        for (int j = 0; j < r; j++) out[j] = in[j*istride];
+    } else {
+        for (int j = 0; j < r; j++) {
+            fft_rec(p, tw, in + j*istride, istride*r, out + j*m, m, stride*r, factors + 1);
+        }
+    }
+
+    // -i for the forward transform, +i for the inverse.
+    float complex mi = (tw == p->twiddle) ? -I : I;
+
+    if (r == 2) {
+        for (int k = 0; k < m; k++) {
+            float complex a = out[k];
+            float complex b = out[k + m] * tw[k*stride];
+            out[k] = a + b;
+            out[k + m] = a - b;
+        }
+    } else if (r == 3) {
+        float complex c = mi * 0.86602540378f;
+        for (int k = 0; k < m; k++) {
+            float complex t0 = out[k];
+            float complex t1 = out[k + m] * tw[k*stride];
+            float complex t2 = out[k + 2*m] * tw[2*k*stride];
+            float complex s = t1 + t2;
+            float complex d = c * (t1 - t2);
+            float complex h = t0 - 0.5f*s;
+            out[k] = t0 + s;
+            out[k + m] = h + d;
+            out[k + 2*m] = h - d;
+        }
+    } else if (r == 4) {
+        for (int k = 0; k < m; k++) {
+            float complex t0 = out[k];
+            float complex t1 = out[k + m] * tw[k*stride];
+            float complex t2 = out[k + 2*m] * tw[2*k*stride];
+            float complex t3 = out[k + 3*m] * tw[3*k*stride];
+            float complex a = t0 + t2;
+            float complex b = t0 - t2;
+            float complex c = t1 + t3;
+            float complex d = mi * (t1 - t3);
+            out[k] = a + c;
+            out[k + m] = b + d;
+            out[k + 2*m] = a - c;
+            out[k + 3*m] = b - d;
+        }
+    } else if (r == 5) {
+        const float c1 = 0.30901699437f, c2 = -0.80901699437f;
+        const float s1 = 0.95105651630f, s2 = 0.58778525229f;
+        for (int k = 0; k < m; k++) {
+            float complex t0 = out[k];
+            float complex t1 = out[k + m] * tw[k*stride];
+            float complex t2 = out[k + 2*m] * tw[2*k*stride];
+            float complex t3 = out[k + 3*m] * tw[3*k*stride];
+            float complex t4 = out[k + 4*m] * tw[4*k*stride];
+            float complex a1 = t1 + t4, a2 = t2 + t3;
+            float complex b1 = t1 - t4, b2 = t2 - t3;
+            float complex u1 = t0 + c1*a1 + c2*a2;
+            float complex u2 = t0 + c2*a1 + c1*a2;
+            float complex v1 = mi * (s1*b1 + s2*b2);
+            float complex v2 = mi * (s2*b1 - s1*b2);
+            out[k] = t0 + a1 + a2;
+            out[k + m] = u1 + v1;
+            out[k + 2*m] = u2 + v2;
+            out[k + 3*m] = u2 - v2;
+            out[k + 4*m] = u1 - v1;
+        }
+    } else {
+        // Generic radix r DFT for any other prime factor.
+        float complex t[r];
+        float complex wr[r];
+        for (int j = 0; j < r; j++) wr[j] = tw[j * (p->n / r)];
+        for (int k = 0; k < m; k++) {
+            for (int j = 0; j < r; j++) {
+                t[j] = out[j*m + k] * tw[j*k*stride];
+            }
+            for (int q = 0; q < r; q++) {
+                float complex sum = t[0];
+                int idx = 0;
+                for (int j = 1; j < r; j++) {
+                    idx += q;
+                    if (idx >= r) idx -= r;
+                    sum += t[j] * wr[idx];
+                }
+                out[q*m + k] = sum;
+            }
+        }
+    }
+}
+
+// Forward transform, out[k] = sum_x in[x] exp(-2 pi i k x / n).
+// in and out must not overlap.
+void fft(fft_plan p, const float complex *in, float complex *out)
+{
+    if (p.n == 1) out[0] = in[0];
+    else fft_rec(&p, p.twiddle, in, 1, out, p.n, 1, p.factors);
+}
+
+// Inverse transform including the 1/n scale, so ifft(fft(x)) == x.
+// in and out must not overlap.
+void ifft(fft_plan p, const float complex *in, float complex *out)
+{
+    if (p.n == 1) out[0] = in[0];
+    else fft_rec(&p, p.itwiddle, in, 1, out, p.n, 1, p.factors);
+    float scale = 1.0f / p.n;
+    for (int i = 0; i < p.n; i++) out[i] *= scale;
+}
+
+// Number of columns gathered together by the 2d column pass. 8 complex
+// floats are one 64 byte cache line.
+#define FFT_COL_BLOCK 8
+
+// Transforms every column of an h x cols complex array in place. Columns
+// are gathered a block at a time so the strided reads touch each cache line
+// once.
+// const float complex *tw: ph.twiddle or ph.itwiddle.
+// float scale: applied to the results, 1/h for the inverse.
+static void fft_columns(fft_plan ph, const float complex *tw, float complex *a, int cols, float scale)
+{
+    int h = ph.n;
+    float complex *in = calloc(h*FFT_COL_BLOCK, sizeof(float complex));
+    float complex *out = calloc(h*FFT_COL_BLOCK, sizeof(float complex));
+    for (int k0 = 0; k0 < cols; k0 += FFT_COL_BLOCK) {
+        int nb = MIN(FFT_COL_BLOCK, cols - k0);
+        for (int y = 0; y < h; y++) {
+            for (int j = 0; j < nb; j++) in[y*FFT_COL_BLOCK + j] = a[y*cols + k0 + j];
+        }
+        for (int j = 0; j < nb; j++) {
+            if (h == 1) out[j*h] = in[j];
+            else fft_rec(&ph, tw, in + j, FFT_COL_BLOCK, out + j*h, h, 1, ph.factors);
+        }
+        for (int y = 0; y < h; y++) {
+            for (int j = 0; j < nb; j++) a[y*cols + k0 + j] = scale * out[j*h + y];
+        }
+    }
+    free(in);
+    free(out);
+}
+
+// Real to complex 2d transform. Two real rows are packed into the real and
+// imaginary parts of one complex row transform and separated afterwards
+// using Hermitian symmetry, then the w/2+1 kept columns are transformed.
+// fft_plan pw, ph: plans for the row length w and column length h.
+// const float *in: h x w real array.
+// float complex *out: h x (w/2+1) half spectrum.
+void rfft2(fft_plan pw, fft_plan ph, const float *in, float complex *out)
+{
+    int w = pw.n;
+    int h = ph.n;
+    int hw = w/2 + 1;
+    float complex *z = calloc(w, sizeof(float complex));
+    float complex *Z = calloc(w, sizeof(float complex));
+
+    for (int y = 0; y < h; y += 2) {
+        const float *a = in + y*w;
+        const float *b = (y + 1 < h) ? in + (y + 1)*w : 0;
+        for (int x = 0; x < w; x++) z[x] = a[x] + I*(b ? b[x] : 0);
+        fft(pw, z, Z);
+        for (int k = 0; k < hw; k++) {
+            float complex zk = Z[k];
+            float complex zn = conjf(Z[(w - k) % w]);
+            out[y*hw + k] = 0.5f*(zk + zn);
+            if (b) out[(y + 1)*hw + k] = -0.5f*I*(zk - zn);
+        }
+    }
+
+    fft_columns(ph, ph.twiddle, out, hw, 1);
+
+    free(z);
+    free(Z);
+}
+
+// Inverse of rfft2, including the 1/(w*h) scale. The half spectrum must
+// come from a real array (or a product of such spectra).
+// const float complex *in: h x (w/2+1) half spectrum, left unchanged.
+// float *out: h x w real array.
+void irfft2(fft_plan pw, fft_plan ph, const float complex *in, float *out)
+{
+    int w = pw.n;
+    int h = ph.n;
+    int hw = w/2 + 1;
+    float complex *z = calloc(w, sizeof(float complex));
+    float complex *Z = calloc(w, sizeof(float complex));
+    float complex *rows = malloc(h*hw*sizeof(float complex));
+
+    memcpy(rows, in, h*hw*sizeof(float complex));
+    fft_columns(ph, ph.itwiddle, rows, hw, 1.0f / h);
+
+    for (int y = 0; y < h; y += 2) {
+        const float complex *a = rows + y*hw;
+        const float complex *b = (y + 1 < h) ? rows + (y + 1)*hw : 0;
+        for (int x = 0; x < w; x++) {
+            float complex ax = (x < hw) ? a[x] : conjf(a[w - x]);
+            float complex bx = b ? ((x < hw) ? b[x] : conjf(b[w - x])) : 0;
+            Z[x] = ax + I*bx;
+        }
+        ifft(pw, Z, z);
+        for (int x = 0; x < w; x++) out[y*w + x] = crealf(z[x]);
+        if (b) for (int x = 0; x < w; x++) out[(y + 1)*w + x] = cimagf(z[x]);
+    }
+
+    free(rows);
+    free(z);
+    free(Z);
+}
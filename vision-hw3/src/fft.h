@@ -0,0 +1,25 @@
+#ifndef FFT_H
+#define FFT_H
+#include <complex.h>
+
+// A precomputed mixed radix FFT of length n = 2^a 3^b 5^c (other prime
+// factors work too, just slower).
+typedef struct fft_plan{
+    int n;
+    int nfactors;
+    int factors[32];
+    float complex *twiddle;
+    float complex *itwiddle;
+} fft_plan;
+
+fft_plan make_fft_plan(int n);
+void free_fft_plan(fft_plan p);
+int fft_good_size(int n);
+void fft(fft_plan p, const float complex *in, float complex *out);
+void ifft(fft_plan p, const float complex *in, float complex *out);
+
+// 2d real transforms of a h x w row-major array to and from its
+// h x (w/2+1) half spectrum.
+void rfft2(fft_plan pw, fft_plan ph, const float *in, float complex *out);
+void irfft2(fft_plan pw, fft_plan ph, const float complex *in, float *out);
+#endif
@@ -4,22 +4,14 @@
 #include <math.h>
 #include <assert.h>
 #include "image.h"
+#include "fft.h"
+#include "stencil.h"
 #define TWOPI 6.2831853
 
 void l1_normalize(image im) {
-	float sum = 0;
-	for (int c = 0; c < im.c; c++)
-		for (int w = 0; w < im.w; w++)
-			for (int h = 0; h < im.h; h++) {
-				sum += get_pixel(im, w, h, c);
-			}
-
-	for (int c = 0; c < im.c; c++)
-		for (int w = 0; w < im.w; w++)
-			for (int h = 0; h < im.h; h++) {
-				set_pixel(im, w, h, c, (get_pixel(im, w, h, c) / sum));
-			}
-
+	size_t n = (size_t)im.w*im.h*im.c;
+	float sum = reduce_sum(im.data, n);
+	for (size_t i = 0; i < n; i++) im.data[i] /= sum;
 }
 
 image make_box_filter(int w)
@@ -33,41 +25,370 @@ image make_box_filter(int w)
     return box_filter;
 }
 
-image convolve_image(image im, image filter, int preserve)
+// Number of output pixels processed per tile by the interior convolution.
+// 256 floats of accumulators plus the input rows they touch fit in L1.
+#define CONV_TILE 256
+
+// Filters with at least this many taps that aren't separable are convolved
+// with the FFT. Measured crossover is 15x15 for both 640x480 and 2000x1500
+// images, the FFT cost barely depends on the filter size.
+#define CONV_FFT_MIN_AREA 225
+
+static inline int clamp_index(int i, int n)
+{
+    return (i < 0) ? 0 : ((i > n - 1) ? n - 1 : i);
+}
+
+// Convolves a single pixel of a plane, clamping reads to the image edge.
+// Taps are summed in the same order as the interior path so both agree bit
+// for bit.
+// const float *src: w x h plane to read from.
+// const float *f: fw x fh filter plane.
+// int x, y: output pixel.
+// returns: the filter response at (x, y).
+static float convolve_pixel_clamped(const float *src, int w, int h,
+        const float *f, int fw, int fh, int x, int y)
+{
+    int ox = fw/2;
+    int oy = fh/2;
+    float sum = 0;
+    for (int fy = 0; fy < fh; fy++) {
+        const float *row = src + clamp_index(y + fy - oy, h)*w;
+        for (int fx = 0; fx < fw; fx++) {
+            sum += f[fy*fw + fx] * row[clamp_index(x + fx - ox, w)];
+        }
+    }
+    return sum;
+}
+
+// Convolves pixels [x0, x1) of row y whose filter window lies entirely
+// inside the plane. No clamping is needed so the inner loop is a plain
+// multiply-add over contiguous memory, done a tile of columns at a time.
+// float *dst: output row, results are added to it.
+static void convolve_row_interior(const float *src, int w,
+        const float *f, int fw, int fh, int y, int x0, int x1, float *dst)
+{
+    float acc[CONV_TILE];
+    int ox = fw/2;
+    int oy = fh/2;
+    for (int tx = x0; tx < x1; tx += CONV_TILE) {
+        int n = MIN(CONV_TILE, x1 - tx);
+        for (int i = 0; i < n; i++) acc[i] = 0;
+        for (int fy = 0; fy < fh; fy++) {
+            const float *row = src + (y + fy - oy)*w + tx - ox;
+            for (int fx = 0; fx < fw; fx++) {
+                float k = f[fy*fw + fx];
+                const float *p = row + fx;
+                for (int i = 0; i < n; i++) acc[i] += k * p[i];
+            }
+        }
+        for (int i = 0; i < n; i++) dst[tx + i] += acc[i];
+    }
+}
+
+// Convolves one plane with one filter plane and adds the result to dst.
+// Rows and columns whose window stays inside the image take the fast
+// interior path, the remaining border uses clamped reads.
+// const float *src: w x h input plane.
+// const float *f: fw x fh filter plane.
+// float *dst: w x h output plane, must be zeroed or hold a partial sum.
+static void convolve_plane(const float *src, int w, int h,
+        const float *f, int fw, int fh, float *dst)
+{
+    // Output pixels in [x0, x1) x [y0, y1) never read outside the plane.
+    int x0 = fw/2;
+    int y0 = fh/2;
+    int x1 = w - (fw - 1 - fw/2);
+    int y1 = h - (fh - 1 - fh/2);
+    if (x1 < x0) x1 = x0;
+    if (y1 < y0) y1 = y0;
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; y++) {
+        float *out = dst + y*w;
+        if (y < y0 || y >= y1 || x0 >= x1) {
+            for (int x = 0; x < w; x++) {
+                out[x] += convolve_pixel_clamped(src, w, h, f, fw, fh, x, y);
+            }
+            continue;
+        }
+        for (int x = 0; x < MIN(x0, w); x++) {
+            out[x] += convolve_pixel_clamped(src, w, h, f, fw, fh, x, y);
+        }
+        convolve_row_interior(src, w, f, fw, fh, y, x0, x1, out);
+        for (int x = x1; x < w; x++) {
+            out[x] += convolve_pixel_clamped(src, w, h, f, fw, fh, x, y);
+        }
+    }
+}
+
+// Single channel filters with every tap equal and at least this many taps
+// are applied as window sums over a summed area table. Measured crossover
+// against the separable path is about 9x9 on a 2048x1536 image.
+#define CONV_BOX_MIN_AREA 100
+
+// returns: 1 if all n taps of the filter plane are equal.
+static int constant_plane(const float *f, int n)
+{
+    for (int i = 1; i < n; i++) {
+        if (f[i] != f[0]) return 0;
+    }
+    return 1;
+}
+
+// Convolves with a constant filter through box_filter_rect_into.
+static void convolve_image_box(image im, image filter, int preserve, image out)
+{
+    int size = im.w*im.h;
+    float k = filter.data[0]*filter.w*filter.h;
+    if (preserve == 1) {
+        box_filter_rect_into(im, filter.w, filter.h, out);
+        for (int i = 0; i < size*im.c; i++) out.data[i] *= k;
+        return;
+    }
+    image box = uw_arena_image(im.w, im.h, im.c);
+    box_filter_rect_into(im, filter.w, filter.h, box);
+    memset(out.data, 0, size*sizeof(float));
+    for (int ch = 0; ch < im.c; ch++) {
+        const float *src = box.data + ch*size;
+        for (int i = 0; i < size; i++) out.data[i] += k*src[i];
+    }
+    uw_arena_pop(box.data);
+}
+
+// Tries to factor a filter plane into a column and a row vector so that
+// f[y*fw + x] == col[y]*row[x]. Box, Gaussian and Sobel filters all factor.
+// const float *f: fw x fh filter plane.
+// float *row: fw floats, filled with the row factor.
+// float *col: fh floats, filled with the column factor.
+// returns: 1 if the plane is rank 1 up to float rounding, 0 otherwise.
+static int factor_separable(const float *f, int fw, int fh, float *row, float *col)
+{
+    int n = fw*fh;
+    int p = 0;
+    for (int i = 1; i < n; i++) {
+        if (fabsf(f[i]) > fabsf(f[p])) p = i;
+    }
+    float max = fabsf(f[p]);
+    if (max == 0) return 0;
+
+    int px = p % fw;
+    int py = p / fw;
+    for (int x = 0; x < fw; x++) row[x] = f[py*fw + x];
+    for (int y = 0; y < fh; y++) col[y] = f[y*fw + px] / f[p];
+
+    float tol = 1e-5f * max;
+    for (int y = 0; y < fh; y++) {
+        for (int x = 0; x < fw; x++) {
+            if (fabsf(f[y*fw + x] - col[y]*row[x]) > tol) return 0;
+        }
+    }
+    return 1;
+}
+
+// Separable filtering only pays off once the two 1d passes are clearly
+// cheaper than the 2d one; a 3x3 filter is faster done directly.
+static int worth_separating(int fw, int fh)
+{
+    return fw > 1 && fh > 1 && fw*fh > 2*(fw + fh);
+}
+
+// Big filters that don't factor are cheaper in the frequency domain,
+// unless they overhang the image, whose few pixels are then cheaper to
+// convolve directly than to pad out to the filter's size.
+// int nseparable: filter channels that take the two pass path.
+static int worth_fft(image im, image filter, int nseparable)
+{
+    return nseparable < filter.c && filter.w*filter.h >= CONV_FFT_MIN_AREA &&
+        filter.w <= im.w && filter.h <= im.h;
+}
+
+// Whether convolve_image sends an image and filter to the FFT path.
+// Callers that convolve an image in pieces use it to convolve the whole
+// image instead, rather than building the transforms for every piece.
+int convolve_image_uses_fft(image im, image filter)
+{
+    int fsize = filter.w*filter.h;
+    if (fsize < CONV_FFT_MIN_AREA) return 0;
+    if (filter.c == 1 && fsize >= CONV_BOX_MIN_AREA && constant_plane(filter.data, fsize)) return 0;
+    float *rows = uw_arena_push((filter.w + filter.h)*sizeof(float));
+    int nseparable = 0;
+    for (int fc = 0; fc < filter.c; fc++) {
+        nseparable += worth_separating(filter.w, filter.h) &&
+            factor_separable(filter.data + fc*fsize, filter.w, filter.h, rows, rows + filter.w);
+    }
+    uw_arena_pop(rows);
+    return worth_fft(im, filter, nseparable);
+}
+
+// Convolves an image with a filter by pointwise multiplication in the
+// frequency domain. Uses the same clamp-to-edge padding and preserve
+// semantics as convolve_image and agrees with it up to float rounding.
+// Cost is independent of the filter size, so it wins for large filters
+// that don't factor into 1d passes.
+// image out: im.w x im.h with im.c channels if preserve is 1, else 1.
+void convolve_image_fft_into(image im, image filter, int preserve, image out)
 {
-	// TODO
     assert(im.c == filter.c || filter.c == 1);
-    image conv_im;
-    if (preserve == 1)
-        conv_im = make_image(im.w, im.h, im.c);
-    else
-        conv_im = make_image(im.w, im.h, 1);
+    assert(out.w == im.w && out.h == im.h && out.c == (preserve == 1 ? im.c : 1));
+    image conv_im = out;
+
+    // Pad to at least w + fw - 1 so the circular correlation never wraps
+    // for the pixels we keep.
+    int pw = im.w + filter.w - 1;
+    int ph = im.h + filter.h - 1;
+    int W = fft_good_size(pw);
+    int H = fft_good_size(ph);
+    int hw = W/2 + 1;
+    int size = im.w*im.h;
+    int fsize = filter.w*filter.h;
+    fft_plan plan_w = make_fft_plan(W);
+    fft_plan plan_h = make_fft_plan(H);
+    float *pad = calloc(W*H, sizeof(float));
+    float complex *fspec = calloc(filter.c*H*hw, sizeof(float complex));
+    float complex *spec = calloc(H*hw, sizeof(float complex));
+    float complex *acc = (preserve == 1) ? 0 : calloc(H*hw, sizeof(float complex));
+
+    for (int fc = 0; fc < filter.c; fc++) {
+        memset(pad, 0, W*H*sizeof(float));
+        for (int y = 0; y < filter.h; y++) {
+            memcpy(pad + y*W, filter.data + fc*fsize + y*filter.w, filter.w*sizeof(float));
+        }
+        rfft2(plan_w, plan_h, pad, fspec + fc*H*hw);
+    }
+
+    // The mean of each channel is taken out before the transform and its
+    // response mean*sum(filter) added back after. Images are mostly DC and
+    // a large DC term costs the FFT most of its float precision.
+    int ox = filter.w/2;
+    int oy = filter.h/2;
+    float offset = 0;
     for (int ch = 0; ch < im.c; ch++) {
-        for (int y = 0; y < im.h; y++) {
-            for (int x = 0; x < im.w; x++) {
-                float sum = 0;
-                for (int fy = 0; fy < filter.h; fy++) {
-                    for (int fx = 0; fx < filter.w; fx++) {
-                        int fc = 0;
-                        if (im.c == filter.c) {
-                            fc = ch;
-                        }
-                        sum += filter.data[fc * filter.h * filter.w + fy * filter.w + fx] *
-                            get_pixel(im, x + fx - (filter.w / 2), y + fy - (filter.h / 2), ch);
-                    }
-                }
-                if (preserve == 1)
-                    conv_im.data[ch * conv_im.h * conv_im.w + y * conv_im.w + x] = sum;
-                else
-                    conv_im.data[y * conv_im.w + x] += sum;
+        int fc = (im.c == filter.c) ? ch : 0;
+        const float *src = im.data + ch*size;
+        const float *fdata = filter.data + fc*fsize;
+        double mean = 0, fsum = 0;
+        for (int i = 0; i < size; i++) mean += src[i];
+        for (int i = 0; i < fsize; i++) fsum += fdata[i];
+        mean /= size;
+
+        for (int y = 0; y < ph; y++) {
+            const float *row = src + clamp_index(y - oy, im.h)*im.w;
+            for (int x = 0; x < pw; x++) {
+                pad[y*W + x] = row[clamp_index(x - ox, im.w)] - mean;
             }
         }
+        rfft2(plan_w, plan_h, pad, spec);
+
+        // Correlation, not convolution: multiply by the conjugate.
+        const float complex *f = fspec + fc*H*hw;
+        if (preserve == 1) {
+            for (int i = 0; i < H*hw; i++) spec[i] *= conjf(f[i]);
+            irfft2(plan_w, plan_h, spec, pad);
+            float *dst = conv_im.data + ch*size;
+            for (int y = 0; y < im.h; y++) {
+                for (int x = 0; x < im.w; x++) dst[y*im.w + x] = pad[y*W + x] + mean*fsum;
+            }
+        } else {
+            for (int i = 0; i < H*hw; i++) acc[i] += spec[i] * conjf(f[i]);
+            offset += mean*fsum;
+        }
+    }
+
+    // Channels sum linearly, so one inverse transform covers them all.
+    if (preserve != 1) {
+        irfft2(plan_w, plan_h, acc, pad);
+        for (int y = 0; y < im.h; y++) {
+            for (int x = 0; x < im.w; x++) conv_im.data[y*im.w + x] = pad[y*W + x] + offset;
+        }
     }
-    // for (int y = 0; y < conv_im.h; y++) {
-    //     for (int x = 0; x < conv_im.w; x++) {
-    //         printf("conv_im: x %d, y %d: %f\n", x, y, get_pixel(conv_im, x, y, 1));
-    //     }
-    // }
+
+    free_fft_plan(plan_w);
+    free_fft_plan(plan_h);
+    free(pad);
+    free(fspec);
+    free(spec);
+    free(acc);
+}
+
+image convolve_image_fft(image im, image filter, int preserve)
+{
+    image conv_im = make_image(im.w, im.h, (preserve == 1) ? im.c : 1);
+    convolve_image_fft_into(im, filter, preserve, conv_im);
+    return conv_im;
+}
+
+// Convolves an image with a filter into an existing image. Scratch space
+// comes from the calling thread's arena.
+// image im: image to filter.
+// image filter: filter with 1 channel or as many as im.
+// int preserve: 1 to filter every channel separately, 0 to sum them.
+// image out: im.w x im.h with im.c channels if preserve is 1, else 1.
+void convolve_image_into(image im, image filter, int preserve, image out)
+{
+    assert(im.c == filter.c || filter.c == 1);
+    assert(out.w == im.w && out.h == im.h && out.c == (preserve == 1 ? im.c : 1));
+    int size = im.w*im.h;
+    int fsize = filter.w*filter.h;
+
+    if (filter.c == 1 && fsize >= CONV_BOX_MIN_AREA && constant_plane(filter.data, fsize)) {
+        convolve_image_box(im, filter, preserve, out);
+        return;
+    }
+
+    // Factor each filter channel once. Rank 1 channels are applied as a
+    // horizontal pass into tmp followed by a vertical pass into the output.
+    int *separable = uw_arena_push(filter.c*sizeof(int));
+    float *rows = uw_arena_push(filter.c*filter.w*sizeof(float));
+    float *cols = uw_arena_push(filter.c*filter.h*sizeof(float));
+    int nseparable = 0;
+    for (int fc = 0; fc < filter.c; fc++) {
+        separable[fc] = worth_separating(filter.w, filter.h) &&
+            factor_separable(filter.data + fc*fsize, filter.w, filter.h,
+                    rows + fc*filter.w, cols + fc*filter.h);
+        nseparable += separable[fc];
+    }
+
+    if (worth_fft(im, filter, nseparable)) {
+        uw_arena_pop(separable);
+        convolve_image_fft_into(im, filter, preserve, out);
+        return;
+    }
+
+    memset(out.data, 0, out.w*out.h*out.c*sizeof(float));
+    float *tmp = nseparable ? uw_arena_push(size*sizeof(float)) : 0;
+
+    // The 3x3 kernels read their border from a padded copy of the current
+    // channel instead of clamping. One plane is reused for every channel.
+    int stencil = filter.w == 3 && filter.h == 3 && get_stencil_impl() != STENCIL_NONE;
+    padded_image padded = {0};
+    if (stencil) padded = uw_arena_image_padded(im.w, im.h, 1, 1);
+
+    for (int ch = 0; ch < im.c; ch++) {
+        int fc = (im.c == filter.c) ? ch : 0;
+        const float *src = im.data + ch*size;
+        float *dst = (preserve == 1) ? out.data + ch*size : out.data;
+        if (separable[fc]) {
+            memset(tmp, 0, size*sizeof(float));
+            convolve_plane(src, im.w, im.h, rows + fc*filter.w, filter.w, 1, tmp);
+            convolve_plane(tmp, im.w, im.h, cols + fc*filter.h, 1, filter.h, dst);
+        } else if (stencil) {
+            pad_channel(im, ch, padded, 0, BORDER_CLAMP);
+            convolve3x3_plane(padded.data, padded.stride, im.w, im.h,
+                    filter.data + fc*fsize, dst);
+        } else {
+            convolve_plane(src, im.w, im.h,
+                    filter.data + fc*fsize, filter.w, filter.h, dst);
+        }
+    }
+
+    uw_arena_pop(separable);
+}
+
+image convolve_image(image im, image filter, int preserve)
+{
+    image conv_im = make_image(im.w, im.h, (preserve == 1) ? im.c : 1);
+    convolve_image_into(im, filter, preserve, conv_im);
     return conv_im;
 }
 
@@ -127,28 +448,38 @@ image make_gaussian_filter(float sigma)
     return ga_f;
 }
 
+// Adds two images of the same size into an existing image.
+// image out: same size as a and b, may be either of them.
+void add_image_into(image a, image b, image out)
+{
+    assert(a.w == b.w && a.h == b.h && a.c == b.c);
+    assert(out.w == a.w && out.h == a.h && out.c == a.c);
+    int n = a.w*a.h*a.c;
+    for (int i = 0; i < n; i++) out.data[i] = a.data[i] + b.data[i];
+}
+
 image add_image(image a, image b)
 {
     image added_image = make_image(a.w, a.h, a.c);
-	for (unsigned int h = 0; h < a.h; h++)
-		for (unsigned int w = 0; w < a.w; w++) {
-			set_pixel(added_image, w, h, 0, (get_pixel(a, w, h, 0) + get_pixel(b, w, h, 0)));
-			set_pixel(added_image, w, h, 1, (get_pixel(a, w, h, 1) + get_pixel(b, w, h, 1)));
-			set_pixel(added_image, w, h, 2, (get_pixel(a, w, h, 2) + get_pixel(b, w, h, 2)));
-		}
-	return added_image;
+    add_image_into(a, b, added_image);
+    return added_image;
+}
+
+// Subtracts b from a into an existing image.
+// image out: same size as a and b, may be either of them.
+void sub_image_into(image a, image b, image out)
+{
+    assert(a.w == b.w && a.h == b.h && a.c == b.c);
+    assert(out.w == a.w && out.h == a.h && out.c == a.c);
+    int n = a.w*a.h*a.c;
+    for (int i = 0; i < n; i++) out.data[i] = a.data[i] - b.data[i];
 }
 
 image sub_image(image a, image b)
 {
     image subed_image = make_image(a.w, a.h, a.c);
-	for (unsigned int h = 0; h < a.h; h++)
-		for (unsigned int w = 0; w < a.w; w++) {
-			set_pixel(subed_image, w, h, 0, (get_pixel(a, w, h, 0) - get_pixel(b, w, h, 0)));
-			set_pixel(subed_image, w, h, 1, (get_pixel(a, w, h, 1) - get_pixel(b, w, h, 1)));
-			set_pixel(subed_image, w, h, 2, (get_pixel(a, w, h, 2) - get_pixel(b, w, h, 2)));
-		}
-	return subed_image;
+    sub_image_into(a, b, subed_image);
+    return subed_image;
 }
 
 image make_gx_filter()
@@ -173,87 +504,150 @@ image make_gy_filter()
 
 void feature_normalize(image im)
 {
-	float min = 1;
-	float max = -1;
-	float pixel;
-    for (unsigned int c = 0; c < im.c; c++)
-		for (unsigned int h = 0; h < im.h; h++)
-			for (unsigned int w = 0; w < im.w; w++) {
-				pixel = get_pixel(im, w, h, c);
-				if (pixel < min) min = pixel;
-				if (pixel > max) max = pixel;
-			}
-	
+	size_t n = (size_t)im.w*im.h*im.c;
+	if (n == 0) return;
+	float min, max;
+	reduce_min_max(im.data, n, &min, &max);
+
 	float range = max - min;
 	if (range == 0) {
-		for (unsigned int c = 0; c < im.c; c++)
-    		for (unsigned int h = 0; h < im.h; h++)
-    			for (unsigned int w = 0; w < im.w; w++) {
-    				set_pixel(im, w, h, c, 0);
-    			}
-        return;
+		memset(im.data, 0, n*sizeof(float));
+		return;
 	}
+	for (size_t i = 0; i < n; i++) im.data[i] = (im.data[i] - min) / range;
+}
 
-	for (unsigned int c = 0; c < im.c; c++)
-		for (unsigned int h = 0; h < im.h; h++)
-			for (unsigned int w = 0; w < im.w; w++) {
-				pixel = get_pixel(im, w, h, c);
-				set_pixel(im, w, h, c, (pixel - min) / range);
-			}
+// atan2 from a degree 9 minimax polynomial on [0,1] plus octant fix-ups,
+// written with selects so row loops vectorize. Max error is about 1e-5
+// radians, atan2(0, 0) is 0.
+static inline float fast_atan2f(float y, float x)
+{
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float mx = MAX(ax, ay);
+    float mn = MIN(ax, ay);
+    float a = (mx > 0) ? mn / mx : 0;
+    float s = a*a;
+    float r = a*(0.9998660f + s*(-0.3302995f + s*(0.1801410f + s*(-0.0851330f + s*0.0208351f))));
+    r = (ay > ax) ? 1.57079637f - r : r;
+    r = (x < 0) ? 3.14159274f - r : r;
+    return (y < 0) ? -r : r;
 }
 
-image *sobel_image(image im)
+// Sobel responses of one output row, summed over channels like
+// convolve_image with preserve = 0.
+// image im: source image.
+// int y: row to compute.
+// float *gx, *gy: w floats of scratch for the row gradients.
+// float *mag: w magnitudes for the row.
+// float *dir: w gradient directions, or 0 to skip them.
+static void sobel_row(image im, int y, float *gx, float *gy, float *mag, float *dir)
 {
-	image *res = calloc(2, sizeof(image));
-	image gx_filter = make_gx_filter();
-	image gy_filter = make_gy_filter();
-	image gx_conv = convolve_image(im, gx_filter, 0);
-	image gy_conv = convolve_image(im, gy_filter, 0);
-	
-	image magnitude = make_image(gx_conv.w, gx_conv.h, gx_conv.c);
-	image direction = make_image(gx_conv.w, gx_conv.h, gx_conv.c);
-
-	float gx_pixel, gy_pixel, mag, dir;
-	for (unsigned int h = 0; h < im.h; h++)
-		for (unsigned int w = 0; w < im.w; w++) {
-			gx_pixel = get_pixel(gx_conv, w, h, 0);
-			gy_pixel = get_pixel(gy_conv, w, h, 0);
-			mag = sqrt(gx_pixel*gx_pixel + gy_pixel*gy_pixel);
-			dir = atan(gy_pixel / gx_pixel);
-
-			set_pixel(magnitude, w, h, 0, mag);
-			if (isnan(dir))
-                set_pixel(direction, w, h, 0, 0);
-            else
-				set_pixel(direction, w, h, 0, dir);
-		}
+    int w = im.w;
+    int size = w*im.h;
+    int yu = clamp_index(y - 1, im.h);
+    int yd = clamp_index(y + 1, im.h);
+    memset(gx, 0, w*sizeof(float));
+    memset(gy, 0, w*sizeof(float));
+    for (int c = 0; c < im.c; c++) {
+        const float *r0 = im.data + c*size + yu*w;
+        const float *r1 = im.data + c*size + y*w;
+        const float *r2 = im.data + c*size + yd*w;
+        for (int x = 1; x < w - 1; x++) {
+            gx[x] += (r0[x+1] - r0[x-1]) + 2*(r1[x+1] - r1[x-1]) + (r2[x+1] - r2[x-1]);
+            gy[x] += (r2[x-1] + 2*r2[x] + r2[x+1]) - (r0[x-1] + 2*r0[x] + r0[x+1]);
+        }
+        // Left and right columns clamp their missing neighbor.
+        for (int x = 0; x < w; x += MAX(w - 1, 1)) {
+            int xl = clamp_index(x - 1, w);
+            int xr = clamp_index(x + 1, w);
+            gx[x] += (r0[xr] - r0[xl]) + 2*(r1[xr] - r1[xl]) + (r2[xr] - r2[xl]);
+            gy[x] += (r2[xl] + 2*r2[x] + r2[xr]) - (r0[xl] + 2*r0[x] + r0[xr]);
+        }
+    }
+    for (int x = 0; x < w; x++) mag[x] = sqrtf(gx[x]*gx[x] + gy[x]*gy[x]);
+    if (dir) {
+        for (int x = 0; x < w; x++) dir[x] = fast_atan2f(gy[x], gx[x]);
+    }
+}
 
-	res[0] = magnitude;
-	res[1] = direction;
+// Computes Sobel gradient magnitude and direction in one streaming pass
+// over the image. Only two rows of scratch per thread, the gx and gy images
+// are never materialized.
+// image im: source image.
+// float *mag: w x h output plane for the magnitude.
+// float *dir: w x h output plane for the direction, or 0 to skip it.
+static void sobel_fused(image im, float *mag, float *dir)
+{
+    #pragma omp parallel
+    {
+        float *gx = uw_arena_push(im.w*sizeof(float));
+        float *gy = uw_arena_push(im.w*sizeof(float));
+        #pragma omp for schedule(static)
+        for (int y = 0; y < im.h; y++) {
+            sobel_row(im, y, gx, gy, mag + y*im.w, dir ? dir + y*im.w : 0);
+        }
+        uw_arena_pop(gx);
+    }
+}
 
+// Sobel gradient magnitude and direction into existing images.
+// image mag, dir: im.w x im.h x 1 outputs.
+void sobel_image_into(image im, image mag, image dir)
+{
+    assert(mag.w == im.w && mag.h == im.h && mag.c == 1);
+    assert(dir.w == im.w && dir.h == im.h && dir.c == 1);
+    sobel_fused(im, mag.data, dir.data);
+}
+
+image *sobel_image(image im)
+{
+	image *res = calloc(2, sizeof(image));
+	res[0] = make_image(im.w, im.h, 1);
+	res[1] = make_image(im.w, im.h, 1);
+	sobel_image_into(im, res[0], res[1]);
     return res;
 }
 
-image colorize_sobel(image im)
+// Sobel gradient magnitude only, for callers that don't need direction.
+// image im: source image.
+// image mag: im.w x im.h x 1 output.
+void sobel_magnitude_into(image im, image mag)
 {
-	image col_sobel = make_image(im.w, im.h, im.c);
+    assert(mag.w == im.w && mag.h == im.h && mag.c == 1);
+    sobel_fused(im, mag.data, 0);
+}
 
-	image *sobel = sobel_image(im);
-    image mag = sobel[0];
-    image dir = sobel[1];
-	feature_normalize(mag);
+image sobel_magnitude(image im)
+{
+    image mag = make_image(im.w, im.h, 1);
+    sobel_magnitude_into(im, mag);
+    return mag;
+}
 
-	float mag_pixel, dir_pixel;
-	for (unsigned int h = 0; h < im.h; h++)
-		for (unsigned int w = 0; w < im.w; w++) {
-			mag_pixel = get_pixel(mag, w, h, 0);
-			dir_pixel = get_pixel(dir, w, h, 0);
-			set_pixel(col_sobel, w, h, 0, dir_pixel);
-			set_pixel(col_sobel, w, h, 1, mag_pixel);
-			set_pixel(col_sobel, w, h, 2, mag_pixel);
-		}
+// Colorized Sobel into an existing image.
+// image col_sobel: im.w x im.h x 3 output.
+void colorize_sobel_into(image im, image col_sobel)
+{
+	assert(col_sobel.w == im.w && col_sobel.h == im.h && col_sobel.c == 3);
+	int size = im.w*im.h;
+
+	// Hue is the direction mapped to [0,1], saturation and value are the
+	// normalized magnitude. Compute straight into the output planes.
+	image mag = col_sobel;
+	mag.c = 1;
+	mag.data = col_sobel.data + size;
+	sobel_fused(im, mag.data, col_sobel.data);
+	for (int i = 0; i < size; i++) col_sobel.data[i] = col_sobel.data[i]/TWOPI + .5;
+	feature_normalize(mag);
+	memcpy(col_sobel.data + 2*size, mag.data, size*sizeof(float));
 
 	hsv_to_rgb(col_sobel);
+}
 
+image colorize_sobel(image im)
+{
+	image col_sobel = make_image(im.w, im.h, 3);
+	colorize_sobel_into(im, col_sobel);
 	return col_sobel;
 }
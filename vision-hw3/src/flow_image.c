@@ -41,27 +41,50 @@ void draw_line(image im, float x, float y, float dx, float dy)
     }
 }
 
-// Make an integral image or summed area table from an image
-// image im: image to process
-// returns: image I such that I[x,y] = sum{i<=x, j<=y}(im[i,j])
-image make_integral_image(image im)
+// Calculate the time-structure matrix of an image pair into an existing
+// image. Temporaries live on the scratch arena.
+// image im: the input image.
+// image prev: the previous image in sequence.
+// int s: window size for smoothing.
+// image S: im.w x im.h x 5 output. 1st channel is Ix^2, 2nd channel is
+//          Iy^2, 3rd channel is IxIy, 4th channel is IxIt, 5th is IyIt.
+static void time_structure_matrix_into(image im, image prev, int s, image S)
 {
-    image integ = make_image(im.w, im.h, im.c);
-    // TODO: fill in the integral image
-    return integ;
-}
+    int i;
+    void *mark = uw_arena_push(0);
+    if(im.c == 3){
+        image gray = uw_arena_image(im.w, im.h, 1);
+        image prev_gray = uw_arena_image(prev.w, prev.h, 1);
+        rgb_to_grayscale_into(im, gray);
+        rgb_to_grayscale_into(prev, prev_gray);
+        im = gray;
+        prev = prev_gray;
+    }
 
-// Apply a box filter to an image using an integral image for speed
-// image im: image to smooth
-// int s: window size for box filter
-// returns: smoothed image
-image box_filter_image(image im, int s)
-{
-    int i,j,k;
-    image integ = make_integral_image(im);
-    image S = make_image(im.w, im.h, im.c);
-    // TODO: fill in S using the integral image.
-    return S;
+    float gx[] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
+    float gy[] = {-1, -2, -1, 0, 0, 0, 1, 2, 1};
+    image gx_filter = {3, 3, 1, gx};
+    image gy_filter = {3, 3, 1, gy};
+    image Ix = uw_arena_image(im.w, im.h, 1);
+    image Iy = uw_arena_image(im.w, im.h, 1);
+    image T = uw_arena_image(im.w, im.h, 5);
+    convolve_image_into(im, gx_filter, 0, Ix);
+    convolve_image_into(im, gy_filter, 0, Iy);
+
+    int size = im.w*im.h;
+    #pragma omp parallel for schedule(static)
+    for(i = 0; i < size; ++i){
+        float ix = Ix.data[i];
+        float iy = Iy.data[i];
+        float it = im.data[i] - prev.data[i];
+        T.data[i + 0*size] = ix*ix;
+        T.data[i + 1*size] = iy*iy;
+        T.data[i + 2*size] = ix*iy;
+        T.data[i + 3*size] = ix*it;
+        T.data[i + 4*size] = iy*it;
+    }
+    box_filter_rect_into(T, s, s, S);
+    uw_arena_pop(mark);
 }
 
 // Calculate the time-structure matrix of an image pair.
@@ -72,50 +95,50 @@ image box_filter_image(image im, int s)
 //          3rd channel is IxIy, 4th channel is IxIt, 5th channel is IyIt.
 image time_structure_matrix(image im, image prev, int s)
 {
-    int i;
-    int converted = 0;
-    if(im.c == 3){
-        converted = 1;
-        im = rgb_to_grayscale(im);
-        prev = rgb_to_grayscale(prev);
-    }
-
-    // TODO: calculate gradients, structure components, and smooth them
-
-
-
-
-    if(converted){
-        free_image(im); free_image(prev);
-    }
+    image S = make_image(im.w, im.h, 5);
+    time_structure_matrix_into(im, prev, s, S);
     return S;
 }
 
 // Calculate the velocity given a structure image
 // image S: time-structure image
 // int stride: only calculate subset of pixels for speed
-image velocity_image(image S, int stride)
+// image v: S.w/stride x S.h/stride x 3 output, channel 2 is left alone.
+static void velocity_image_into(image S, int stride, image v)
 {
-    image v = make_image(S.w/stride, S.h/stride, 3);
     int i, j;
-    matrix M = make_matrix(2,2);
-    for(j = (stride-1)/2; j < S.h; j += stride){
-        for(i = (stride-1)/2; i < S.w; i += stride){
+    #pragma omp parallel for private(i) schedule(static)
+    for(j = (stride-1)/2; j < v.h*stride; j += stride){
+        for(i = (stride-1)/2; i < v.w*stride; i += stride){
             float Ixx = S.data[i + S.w*j + 0*S.w*S.h];
             float Iyy = S.data[i + S.w*j + 1*S.w*S.h];
             float Ixy = S.data[i + S.w*j + 2*S.w*S.h];
             float Ixt = S.data[i + S.w*j + 3*S.w*S.h];
             float Iyt = S.data[i + S.w*j + 4*S.w*S.h];
 
-            // TODO: calculate vx and vy using the flow equation
+            // Solve [Ixx Ixy; Ixy Iyy] [vx; vy] = -[Ixt; Iyt] directly,
+            // leaving flat or edge-only windows at zero.
+            float det = Ixx*Iyy - Ixy*Ixy;
             float vx = 0;
             float vy = 0;
+            if(fabsf(det) > 1e-8){
+                vx = -(Iyy*Ixt - Ixy*Iyt) / det;
+                vy = -(Ixx*Iyt - Ixy*Ixt) / det;
+            }
 
             set_pixel(v, i/stride, j/stride, 0, vx);
             set_pixel(v, i/stride, j/stride, 1, vy);
         }
     }
-    free_matrix(M);
+}
+
+// Calculate the velocity given a structure image
+// image S: time-structure image
+// int stride: only calculate subset of pixels for speed
+image velocity_image(image S, int stride)
+{
+    image v = make_image(S.w/stride, S.h/stride, 3);
+    velocity_image_into(S, stride, v);
     return v;
 }
 
@@ -159,12 +182,14 @@ void constrain_image(image im, float v)
 // returns: velocity matrix
 image optical_flow_images(image im, image prev, int smooth, int stride)
 {
-    image S = time_structure_matrix(im, prev, smooth);   
-    image v = velocity_image(S, stride);
+    image S = uw_arena_image(im.w, im.h, 5);
+    image v = uw_arena_image(im.w/stride, im.h/stride, 3);
+    time_structure_matrix_into(im, prev, smooth, S);
+    velocity_image_into(S, stride, v);
     constrain_image(v, 6);
-    image vs = smooth_image(v, 2);
-    free_image(v);
-    free_image(S);
+    image vs = make_image(v.w, v.h, v.c);
+    smooth_image_mode_into(v, 2, SMOOTH_FIR, vs);
+    uw_arena_pop(S.data);
     return vs;
 }
 
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "image.h"
+
+// Young - van Vliet recursive Gaussian. A third order causal filter runs
+// forward, the same filter runs backward over its output, and together
+// they approximate a Gaussian of the given sigma at a fixed cost per pixel.
+//   forward:  w[n] = B x[n] + a1 w[n-1] + a2 w[n-2] + a3 w[n-3]
+//   backward: y[n] = B w[n] + a1 y[n+1] + a2 y[n+2] + a3 y[n+3]
+// Edges are extended with their last value, matching convolve_image. The
+// right edge uses the Triggs - Sdika initialization, so the backward pass
+// starts exactly where an infinitely long constant extension would leave
+// it.
+typedef struct{
+    double B, a1, a2, a3;
+    double M[3][3];
+} iir_gaussian;
+
+// Builds the Triggs - Sdika matrix M, which maps the last three forward
+// outputs (minus the edge value) to the three backward states just past
+// the edge (minus the edge value). Instead of the closed form it runs both
+// passes over a long constant extension once per basis vector.
+static void iir_boundary_matrix(iir_gaussian *g, double sigma)
+{
+    int len = 60*sigma + 100;
+    double *w = uw_arena_push((len + 3)*sizeof(double));
+    double *v = uw_arena_push((len + 6)*sizeof(double));
+    for (int j = 0; j < 3; j++) {
+        // w[0..2] hold w'[N-3], w'[N-2], w'[N-1]; extension starts at 3.
+        memset(w, 0, (len + 3)*sizeof(double));
+        memset(v, 0, (len + 6)*sizeof(double));
+        w[2 - j] = 1;
+        for (int n = 3; n < len + 3; n++) {
+            w[n] = g->a1*w[n-1] + g->a2*w[n-2] + g->a3*w[n-3];
+        }
+        for (int n = len + 2; n >= 3; n--) {
+            v[n] = g->B*w[n] + g->a1*v[n+1] + g->a2*v[n+2] + g->a3*v[n+3];
+        }
+        for (int i = 0; i < 3; i++) g->M[i][j] = v[3 + i];
+    }
+    uw_arena_pop(w);
+}
+
+// Filter coefficients from Young and van Vliet (1995).
+static iir_gaussian make_iir_gaussian(float sigma)
+{
+    double q;
+    if (sigma >= 2.5) q = 0.98711*sigma - 0.96330;
+    else q = 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+    double q2 = q*q;
+    double q3 = q2*q;
+    double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+    double b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+    double b2 = -(1.4281*q2 + 1.26661*q3);
+    double b3 = 0.422205*q3;
+
+    iir_gaussian g;
+    g.a1 = b1/b0;
+    g.a2 = b2/b0;
+    g.a3 = b3/b0;
+    g.B = 1 - (g.a1 + g.a2 + g.a3);
+    iir_boundary_matrix(&g, sigma);
+    return g;
+}
+
+// Filters one row of n samples in place.
+// double *w: n doubles of scratch for the forward pass.
+static void iir_gaussian_line(const iir_gaussian *g, float *x, int n, double *w)
+{
+    double B = g->B, a1 = g->a1, a2 = g->a2, a3 = g->a3;
+    double left = x[0];
+    double w1 = left, w2 = left, w3 = left;
+    for (int i = 0; i < n; i++) {
+        double v = B*x[i] + a1*w1 + a2*w2 + a3*w3;
+        w3 = w2; w2 = w1; w1 = v;
+        w[i] = v;
+    }
+
+    double right = x[n - 1];
+    double d[3];
+    d[0] = w[n - 1] - right;
+    d[1] = (n > 1 ? w[n - 2] : left) - right;
+    d[2] = (n > 2 ? w[n - 3] : left) - right;
+    double y1 = right + g->M[0][0]*d[0] + g->M[0][1]*d[1] + g->M[0][2]*d[2];
+    double y2 = right + g->M[1][0]*d[0] + g->M[1][1]*d[1] + g->M[1][2]*d[2];
+    double y3 = right + g->M[2][0]*d[0] + g->M[2][1]*d[1] + g->M[2][2]*d[2];
+    for (int i = n - 1; i >= 0; i--) {
+        double v = B*w[i] + a1*y1 + a2*y2 + a3*y3;
+        y3 = y2; y2 = y1; y1 = v;
+        x[i] = v;
+    }
+}
+
+// Vertical pass over a whole plane. The recursion runs down the rows with
+// every column updated together, so the inner loops are contiguous and
+// vectorize.
+// float *p: w x h plane, filtered in place.
+// float *wbuf: w*h floats of scratch for the forward pass.
+static void iir_gaussian_columns(const iir_gaussian *g, float *p, int w, int h, float *wbuf)
+{
+    float B = g->B, a1 = g->a1, a2 = g->a2, a3 = g->a3;
+    for (int y = 0; y < h; y++) {
+        const float *x = p + y*w;
+        float *out = wbuf + y*w;
+        // Before the first row the forward state is the first row itself.
+        const float *w1 = (y > 0) ? wbuf + (y - 1)*w : p;
+        const float *w2 = (y > 1) ? wbuf + (y - 2)*w : p;
+        const float *w3 = (y > 2) ? wbuf + (y - 3)*w : p;
+        for (int i = 0; i < w; i++) out[i] = B*x[i] + a1*w1[i] + a2*w2[i] + a3*w3[i];
+    }
+
+    const float *right = p + (h - 1)*w;
+    float *y1 = uw_arena_push(3*w*sizeof(float));
+    float *y2 = y1 + w;
+    float *y3 = y2 + w;
+    const float *d0 = wbuf + (h - 1)*w;
+    const float *d1 = (h > 1) ? wbuf + (h - 2)*w : p;
+    const float *d2 = (h > 2) ? wbuf + (h - 3)*w : p;
+    for (int i = 0; i < w; i++) {
+        float e0 = d0[i] - right[i], e1 = d1[i] - right[i], e2 = d2[i] - right[i];
+        y1[i] = right[i] + g->M[0][0]*e0 + g->M[0][1]*e1 + g->M[0][2]*e2;
+        y2[i] = right[i] + g->M[1][0]*e0 + g->M[1][1]*e1 + g->M[1][2]*e2;
+        y3[i] = right[i] + g->M[2][0]*e0 + g->M[2][1]*e1 + g->M[2][2]*e2;
+    }
+    for (int y = h - 1; y >= 0; y--) {
+        const float *wr = wbuf + y*w;
+        float *out = p + y*w;
+        for (int i = 0; i < w; i++) {
+            float v = B*wr[i] + a1*y1[i] + a2*y2[i] + a3*y3[i];
+            y3[i] = y2[i];
+            y2[i] = y1[i];
+            y1[i] = v;
+            out[i] = v;
+        }
+    }
+    uw_arena_pop(y1);
+}
+
+// Smooths an image with a recursive Gaussian whose cost per pixel does not
+// depend on sigma. The approximation is loose for small sigma (up to 6% of
+// the image range off the FIR result at sigma 1) and tightens as sigma
+// grows, about 2% at sigma 4 and 1% at sigma 16, see test_smooth_iir.
+// image im: image to smooth.
+// float sigma: std dev. of the Gaussian, at least 0.5.
+// image s: output, same size and channels as im, may be im itself.
+void smooth_image_iir_into(image im, float sigma, image s)
+{
+    assert(s.w == im.w && s.h == im.h && s.c == im.c);
+    if (s.data != im.data) memcpy(s.data, im.data, im.w*im.h*im.c*sizeof(float));
+    iir_gaussian g = make_iir_gaussian(sigma);
+    int size = im.w*im.h;
+    float *wbuf = uw_arena_push(size*sizeof(float));
+    for (int c = 0; c < im.c; c++) {
+        float *p = s.data + c*size;
+        #pragma omp parallel
+        {
+            double *w = uw_arena_push(im.w*sizeof(double));
+            #pragma omp for schedule(static)
+            for (int y = 0; y < im.h; y++) {
+                iir_gaussian_line(&g, p + y*im.w, im.w, w);
+            }
+            uw_arena_pop(w);
+        }
+        iir_gaussian_columns(&g, p, im.w, im.h, wbuf);
+    }
+    uw_arena_pop(wbuf);
+}
+
+image smooth_image_iir(image im, float sigma)
+{
+    image s = make_image(im.w, im.h, im.c);
+    smooth_image_iir_into(im, sigma, s);
+    return s;
+}
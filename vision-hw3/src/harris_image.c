@@ -99,47 +99,121 @@ image make_1d_gaussian(float sigma)
     return ga_f;
 }
 
-image make_1d_gaussian_axis(float sigma, int axis)
+// Fills a single row or single column filter with a normalized 1d Gaussian.
+// image f: size x 1 or 1 x size filter, size = 6 sigma rounded up to odd.
+static void fill_1d_gaussian(image f, float sigma)
 {
-    int size = round(sigma * 6);
-    size = (size%2==1) ? size : size+1;
-
-    image ga_f;
-    if (axis == 0) {
-        ga_f = make_image(size, 1, 1);
-    }
-    else {
-        ga_f = make_image(1, size, 1);
-    }
+    int size = f.w*f.h;
     int centre = size/2;
     for(int x = 0; x < size; x++) {
         float s2 = sigma*sigma;
         float r2 = (x-centre)*(x-centre);
-        float v = 1.0/(TWOPI*s2) * exp(-r2/(2*s2));
-        if(axis == 0) {
-            set_pixel(ga_f, x, 0, 0, v);
-        }
-        else {
-            set_pixel(ga_f, 0, x, 0, v);
-        }
+        f.data[x] = 1.0/(TWOPI*s2) * exp(-r2/(2*s2));
     }
+    l1_normalize(f);
+}
 
-    l1_normalize(ga_f);
+static int gaussian_size(float sigma)
+{
+    int size = round(sigma * 6);
+    return (size%2==1) ? size : size+1;
+}
+
+image make_1d_gaussian_axis(float sigma, int axis)
+{
+    int size = gaussian_size(sigma);
+    image ga_f = (axis == 0) ? make_image(size, 1, 1) : make_image(1, size, 1);
+    fill_1d_gaussian(ga_f, sigma);
     return ga_f;
 }
 
+// Smooths an image with a Gaussian into an existing image, choosing how.
+// Filters and the intermediate pass live on the scratch arena.
+// image im: image to smooth.
+// float sigma: std dev. for Gaussian.
+// smooth_mode mode: SMOOTH_FIR for the separable 6 sigma wide filter,
+//                   SMOOTH_IIR for the recursive filter whose cost doesn't
+//                   grow with sigma, SMOOTH_AUTO to pick by sigma.
+// image s: output, same size and channels as im.
+void smooth_image_mode_into(image im, float sigma, smooth_mode mode, image s)
+{
+    if (mode == SMOOTH_AUTO) mode = (sigma >= SMOOTH_IIR_MIN_SIGMA) ? SMOOTH_IIR : SMOOTH_FIR;
+    if (mode == SMOOTH_IIR) {
+        smooth_image_iir_into(im, sigma, s);
+        return;
+    }
+
+    int size = gaussian_size(sigma);
+    image gauss_x = uw_arena_image(size, 1, 1);
+    image gauss_y = uw_arena_image(1, size, 1);
+    image sx = uw_arena_image(im.w, im.h, im.c);
+    fill_1d_gaussian(gauss_x, sigma);
+    fill_1d_gaussian(gauss_y, sigma);
+    convolve_image_into(im, gauss_x, 1, sx);
+    convolve_image_into(sx, gauss_y, 1, s);
+    uw_arena_pop(gauss_x.data);
+}
+
+// Smooths an image with a Gaussian, choosing how.
+// image im: image to smooth.
+// float sigma: std dev. for Gaussian.
+// smooth_mode mode: see smooth_image_mode_into.
+// returns: smoothed image.
+image smooth_image_mode(image im, float sigma, smooth_mode mode)
+{
+    image s = make_image(im.w, im.h, im.c);
+    smooth_image_mode_into(im, sigma, mode, s);
+    return s;
+}
+
+// Smooths an image with the separable Gaussian filter into an existing
+// image. Use smooth_image_mode for the recursive filter.
+// image s: output, same size and channels as im.
+void smooth_image_into(image im, float sigma, image s)
+{
+    smooth_image_mode_into(im, sigma, SMOOTH_FIR, s);
+}
+
 // Smooths an image using separable Gaussian filter.
 // image im: image to smooth.
 // float sigma: std dev. for Gaussian.
 // returns: smoothed image.
 image smooth_image(image im, float sigma)
 {
-    image gauss_x = make_1d_gaussian_axis(sigma, 0);
-    image gauss_y = make_1d_gaussian_axis(sigma, 1);
-    image s = convolve_image(convolve_image(im, gauss_x, 1), gauss_y, 1);
-    free_image(gauss_x);
-    free_image(gauss_y);
-    return s;
+    return smooth_image_mode(im, sigma, SMOOTH_FIR);
+}
+
+// Calculate the structure matrix of an image into an existing image.
+// Gradients and the unsmoothed products live on the scratch arena.
+// image im: the input image.
+// float sigma: std dev. to use for weighted sum.
+// image S: im.w x im.h x 3 output. 1st channel is Ix^2, 2nd channel is
+//          Iy^2, third channel is IxIy.
+void structure_matrix_into(image im, float sigma, image S)
+{
+    assert(S.w == im.w && S.h == im.h && S.c == 3);
+    float gx[] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
+    float gy[] = {-1, -2, -1, 0, 0, 0, 1, 2, 1};
+    image gx_filter = {3, 3, 1, gx};
+    image gy_filter = {3, 3, 1, gy};
+    image Ix = uw_arena_image(im.w, im.h, 1);
+    image Iy = uw_arena_image(im.w, im.h, 1);
+    image P = uw_arena_image(im.w, im.h, 3);
+    convolve_image_into(im, gx_filter, 0, Ix);
+    convolve_image_into(im, gy_filter, 0, Iy);
+
+    int size = im.w*im.h;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < size; i++) {
+        float Ix_pixel = Ix.data[i];
+        float Iy_pixel = Iy.data[i];
+        P.data[i] = Ix_pixel*Ix_pixel;
+        P.data[i + size] = Iy_pixel*Iy_pixel;
+        P.data[i + 2*size] = Ix_pixel*Iy_pixel;
+    }
+
+    smooth_image_mode_into(P, sigma, SMOOTH_FIR, S);
+    uw_arena_pop(Ix.data);
 }
 
 // Calculate the structure matrix of an image.
@@ -150,59 +224,49 @@ image smooth_image(image im, float sigma)
 image structure_matrix(image im, float sigma)
 {
     image S = make_image(im.w, im.h, 3);
-    
-    image gx_filter = make_gx_filter();
-    image gy_filter = make_gy_filter();
-	image Ix = convolve_image(im, gx_filter, 0);
-	image Iy = convolve_image(im, gy_filter, 0);
-
-	float Ix_pixel, Iy_pixel;
-	for (int h = 0; h < S.h; h++)
-		for (int w = 0; w < S.w; w++) {
-			Ix_pixel = get_pixel(Ix, w, h, 0);
-			Iy_pixel = get_pixel(Iy, w, h, 0);
-            //if (Ix_pixel > 1 || Ix_pixel < 0 || Iy_pixel > 1 || Iy_pixel < 0) printf("True ");
-			set_pixel(S, w, h, 0, (Ix_pixel*Ix_pixel));
-			set_pixel(S, w, h, 1, (Iy_pixel*Iy_pixel));
-			set_pixel(S, w, h, 2, (Ix_pixel*Iy_pixel));
-		}
-
-    S = smooth_image(S, sigma);
-
-    free_image(Ix);
-    free_image(Iy);
+    structure_matrix_into(im, sigma, S);
     return S;
 }
 
 // Estimate the cornerness of each pixel given a structure matrix S.
 // image S: structure matrix for an image.
-// returns: a response map of cornerness calculations.
-image cornerness_response(image S)
+// image R: S.w x S.h x 1 output response map.
+void cornerness_response_into(image S, image R)
 {
-    image R = make_image(S.w, S.h, 1);
+    assert(R.w == S.w && R.h == S.h && R.c == 1);
     // We'll use formulation det(S) - alpha * trace(S)^2, alpha = .06.
     float alpha = 0.06f;
-    float Ix, Iy, IxIy, det, trace, resp;
-    for (int w = 0; w < R.w; w++)
-        for (int h = 0; h < R.h; h++) {
-            Ix = get_pixel(S, w, h, 0);
-            Iy = get_pixel(S, w, h, 1);
-            IxIy = get_pixel(S, w, h, 2);
-            det = Ix*Iy - IxIy*IxIy;
-            trace = Ix + Iy;
-            resp = det - alpha * trace*trace;
+    #pragma omp parallel for schedule(static)
+    for (int h = 0; h < R.h; h++)
+        for (int w = 0; w < R.w; w++) {
+            float Ix = get_pixel(S, w, h, 0);
+            float Iy = get_pixel(S, w, h, 1);
+            float IxIy = get_pixel(S, w, h, 2);
+            float det = Ix*Iy - IxIy*IxIy;
+            float trace = Ix + Iy;
+            float resp = det - alpha * trace*trace;
             set_pixel(R, w, h, 0, resp);
         }
+}
+
+// Estimate the cornerness of each pixel given a structure matrix S.
+// image S: structure matrix for an image.
+// returns: a response map of cornerness calculations.
+image cornerness_response(image S)
+{
+    image R = make_image(S.w, S.h, 1);
+    cornerness_response_into(S, R);
     return R;
 }
 
 // Perform non-max supression on an image of feature responses.
 // image im: 1-channel image of feature responses.
 // int w: distance to look for larger responses.
-// returns: image with only local-maxima responses within w pixels.
-image nms_image(image im, int w)
+// image r: output, same size as im, must not be im.
+void nms_image_into(image im, int w, image r)
 {
-    image r = copy_image(im);
+    assert(r.w == im.w && r.h == im.h && r.c == im.c && r.data != im.data);
+    memcpy(r.data, im.data, im.w*im.h*im.c*sizeof(float));
     // TODO: perform NMS on the response map.
     // for every pixel in the image:
     //     for neighbors within w:
@@ -211,16 +275,15 @@ image nms_image(image im, int w)
 
     int side = (2*w + 1);
     int half = (w % 2 == 1) ? ((side - 1) / 2) : (side / 2);
-    int isGreater = 0;
-    float pixel, w_pixel;
-    for (int x = 0; x < r.w; x++)
-        for (int y = 0; y < r.h; y++) {
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < r.h; y++)
+        for (int x = 0; x < r.w; x++) {
 
-            isGreater = 0;
+            int isGreater = 0;
             for(int w_x = 0; w_x < side; w_x++) {
                 for(int w_y = 0; w_y < side; w_y++) {
-                    pixel = get_pixel(im, x, y, 0);
-                    w_pixel = get_pixel(im, x + w_x - half, y + w_y - half, 0);
+                    float pixel = get_pixel(im, x, y, 0);
+                    float w_pixel = get_pixel(im, x + w_x - half, y + w_y - half, 0);
                     if (w_pixel > pixel) {
                         isGreater = 1;
                         set_pixel(r, x, y, 0, -999999);
@@ -230,6 +293,16 @@ image nms_image(image im, int w)
                 if(isGreater) break;
             }
         }
+}
+
+// Perform non-max supression on an image of feature responses.
+// image im: 1-channel image of feature responses.
+// int w: distance to look for larger responses.
+// returns: image with only local-maxima responses within w pixels.
+image nms_image(image im, int w)
+{
+    image r = make_image(im.w, im.h, im.c);
+    nms_image_into(im, w, r);
     return r;
 }
 
@@ -243,13 +316,16 @@ image nms_image(image im, int w)
 descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms, int *n)
 {
     // Calculate structure matrix
-    image S = structure_matrix(im, sigma);
+    image S = uw_arena_image(im.w, im.h, 3);
+    structure_matrix_into(im, sigma, S);
 
     // Estimate cornerness
-    image R = cornerness_response(S);
+    image R = uw_arena_image(im.w, im.h, 1);
+    cornerness_response_into(S, R);
 
     // Run NMS on the responses
-    image Rnms = nms_image(R, nms);
+    image Rnms = uw_arena_image(im.w, im.h, 1);
+    nms_image_into(R, nms, Rnms);
 
 
     //TODO: count number of responses over threshold
@@ -274,10 +350,6 @@ descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms,
         }
     }
 
-    
-    image *sobel = sobel_image(im);
-    image grad_image = copy_image(sobel[1]);
-    feature_normalize(grad_image);
 
     *n = count; // <- set *n equal to number of corners in image.
     descriptor *d = calloc(count, sizeof(descriptor));
@@ -300,11 +372,7 @@ descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms,
         }
     }
 
-    free_image(S);
-    free_image(R);
-    free_image(Rnms);
-    free_image(grad_image);
-    free(sobel);
+    uw_arena_pop(S.data);
     return d;
 }
 
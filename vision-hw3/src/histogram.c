@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "image.h"
+
+// Histograms of image channels over [0, 1] and the contrast adjustments
+// built on them: global equalization, which maps every value through the
+// cumulative histogram of its channel, and CLAHE, which does the same per
+// tile with a clipped histogram and blends neighbouring tiles' mappings so
+// tile edges don't show.
+
+// The bin a value in [0, 1] falls in, matching reduce_histogram.
+static inline int value_bin(float v, int bins)
+{
+    float f = v*bins;
+    return (f <= 0) ? 0 : (f >= bins - 1) ? bins - 1 : (int)f;
+}
+
+// Counts every channel of an image into bins equal width bins over [0, 1].
+// Values outside the range land in the end bins.
+// int bins: bins per channel.
+// int *counts: im.c*bins counts, channel k's bins start at counts[k*bins].
+void image_histogram(image im, int bins, int *counts)
+{
+    assert(bins > 0);
+    size_t size = (size_t)im.w*im.h;
+    for (int k = 0; k < im.c; k++) {
+        reduce_histogram(im.data + k*size, size, bins, 0, 1, counts + k*bins);
+    }
+}
+
+// Turns counts into the equalizing map: lut[k] is the fraction of the
+// counted values past the first occupied bin that are in bins up to k, so
+// the darkest occupied bin maps to 0 and the last to 1.
+// returns: 0 if all values share one bin and there is nothing to spread.
+static int cdf_lut(const float *counts, int bins, float *lut)
+{
+    double total = 0, first = 0;
+    for (int k = 0; k < bins; k++) {
+        total += counts[k];
+        if (first == 0) first = total;
+        lut[k] = total;
+    }
+    if (total - first <= 0) return 0;
+    for (int k = 0; k < bins; k++) lut[k] = MAX(lut[k] - first, 0)/(total - first);
+    return 1;
+}
+
+// Equalizes channels of an image in place so their values spread evenly
+// over [0, 1]. For color images, equalize the value channel of an
+// rgb_to_hsv image rather than each of r, g and b.
+// int c: channel to equalize, -1 for all of them.
+// int bins: histogram bins, 256 matches 8 bit images.
+void equalize_image(image im, int c, int bins)
+{
+    assert(bins > 0 && c < im.c);
+    size_t size = (size_t)im.w*im.h;
+    int *counts = uw_arena_push(bins*sizeof(int));
+    float *lut = uw_arena_push(2*bins*sizeof(float));
+    float *fcounts = lut + bins;
+    for (int k = (c < 0) ? 0 : c; k < ((c < 0) ? im.c : c + 1); k++) {
+        float *p = im.data + k*size;
+        reduce_histogram(p, size, bins, 0, 1, counts);
+        for (int b = 0; b < bins; b++) fcounts[b] = counts[b];
+        if (!cdf_lut(fcounts, bins, lut)) continue;
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < size; i++) p[i] = lut[value_bin(p[i], bins)];
+    }
+    uw_arena_pop(lut);
+    uw_arena_pop(counts);
+}
+
+// Clips a tile's counts at limit and hands what was cut off back to every
+// bin evenly, which caps how steep the tile's mapping can get.
+static void clip_counts(float *counts, int bins, float limit)
+{
+    float excess = 0;
+    for (int k = 0; k < bins; k++) {
+        if (counts[k] > limit) {
+            excess += counts[k] - limit;
+            counts[k] = limit;
+        }
+    }
+    float share = excess/bins;
+    for (int k = 0; k < bins; k++) counts[k] += share;
+}
+
+// Finds which two tiles along an axis a pixel blends between, and how far
+// it is from the first tile's center to the second's.
+static void tile_blend(int x, int n, int tiles, int *t0, int *t1, float *a)
+{
+    float f = MAX((x + .5f)*tiles/n - .5f, 0);
+    *t0 = MIN((int)f, tiles - 1);
+    *t1 = MIN(*t0 + 1, tiles - 1);
+    *a = MIN(f - *t0, 1);
+}
+
+// Contrast limited adaptive histogram equalization, in place. Each channel
+// is cut into a tiles x tiles grid; every tile gets its own equalizing map
+// from its clipped histogram, and each pixel blends the maps of the four
+// tiles whose centers surround it. With one tile and no clipping this is
+// equalize_image.
+// int c: channel to equalize, -1 for all of them.
+// int tiles: tiles along each side, 8 is typical.
+// int bins: histogram bins per tile.
+// float clip: highest bin count allowed, as a multiple of the tile's mean
+//             count per bin; 0 or less disables clipping. 2 to 4 is typical.
+void clahe_image(image im, int c, int tiles, int bins, float clip)
+{
+    assert(tiles > 0 && bins > 0 && c < im.c);
+    tiles = MIN(tiles, MIN(im.w, im.h));
+    size_t size = (size_t)im.w*im.h;
+    int ntiles = tiles*tiles;
+    float *luts = uw_arena_push((size_t)ntiles*bins*sizeof(float));
+    for (int k = (c < 0) ? 0 : c; k < ((c < 0) ? im.c : c + 1); k++) {
+        float *p = im.data + k*size;
+        // Tiles count into their own bins, so they run in parallel
+        // without sharing anything.
+        #pragma omp parallel for schedule(dynamic)
+        for (int t = 0; t < ntiles; t++) {
+            int tx = t%tiles, ty = t/tiles;
+            int x0 = tx*im.w/tiles, x1 = (tx + 1)*im.w/tiles;
+            int y0 = ty*im.h/tiles, y1 = (ty + 1)*im.h/tiles;
+            float *counts = uw_arena_push(bins*sizeof(float));
+            for (int b = 0; b < bins; b++) counts[b] = 0;
+            for (int y = y0; y < y1; y++) {
+                const float *row = p + (size_t)y*im.w;
+                for (int x = x0; x < x1; x++) counts[value_bin(row[x], bins)]++;
+            }
+            if (clip > 0) {
+                float n = (float)(x1 - x0)*(y1 - y0);
+                clip_counts(counts, bins, MAX(clip*n/bins, 1));
+            }
+            float *lut = luts + (size_t)t*bins;
+            if (!cdf_lut(counts, bins, lut)) {
+                // A flat tile keeps its values, to within a bin.
+                for (int b = 0; b < bins; b++) lut[b] = (b + .5f)/bins;
+            }
+            uw_arena_pop(counts);
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < im.h; y++) {
+            int ty0, ty1;
+            float ay;
+            tile_blend(y, im.h, tiles, &ty0, &ty1, &ay);
+            const float *l0 = luts + (size_t)ty0*tiles*bins;
+            const float *l1 = luts + (size_t)ty1*tiles*bins;
+            float *row = p + (size_t)y*im.w;
+            for (int x = 0; x < im.w; x++) {
+                int tx0, tx1;
+                float ax;
+                tile_blend(x, im.w, tiles, &tx0, &tx1, &ax);
+                int b = value_bin(row[x], bins);
+                float top = l0[tx0*bins + b] + ax*(l0[tx1*bins + b] - l0[tx0*bins + b]);
+                float bot = l1[tx0*bins + b] + ax*(l1[tx1*bins + b] - l1[tx0*bins + b]);
+                row[x] = top + ay*(bot - top);
+            }
+        }
+    }
+    uw_arena_pop(luts);
+}
@@ -1,6 +1,7 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <stddef.h>
 #include "matrix.h"
 #define TWOPI 6.2831853
 
@@ -14,6 +15,28 @@ typedef struct{
     float *data;
 } image;
 
+// How the samples of an 8 bit image are ordered. Planar keeps each
+// channel in its own plane like image, interleaved keeps the channels of
+// a pixel together like image files do.
+typedef enum{
+    LAYOUT_PLANAR, LAYOUT_INTERLEAVED
+} image_layout;
+
+// An 8 bit image with 0..255 standing for 0..1.
+// image_layout layout: channel k of pixel (x, y) is at data[(k*h + y)*w + x]
+//                     if planar, data[(y*w + x)*c + k] if interleaved.
+typedef struct{
+    int w,h,c;
+    image_layout layout;
+    unsigned char *data;
+} image_u8;
+
+// A half precision image, planar like image, samples are IEEE binary16.
+typedef struct{
+    int w,h,c;
+    unsigned short *data;
+} image_f16;
+
 // A 2d point.
 // float x, y: the coordinates of the point.
 typedef struct{
@@ -40,11 +63,141 @@ typedef struct{
     float distance;
 } match;
 
+// An image surrounded by a border of pad pixels, with 64 byte aligned rows,
+// so kernels can read neighbors past the edge without branching.
+// int w, h, c: size of the image inside the border.
+// int pad: border width on every side.
+// int stride: floats between rows, a multiple of 16.
+// int plane: floats between channels.
+// float *data: pixel (0, 0) of channel 0, (x, y, c) is at
+//              data[c*plane + y*stride + x] for x, y from -pad.
+// float *base: start of the allocation.
+typedef struct{
+    int w, h, c;
+    int pad;
+    int stride;
+    int plane;
+    float *data;
+    float *base;
+} padded_image;
+
+// How fill_border extends an image past its edge.
+typedef enum{
+    BORDER_CLAMP, BORDER_REFLECT, BORDER_ZERO
+} border_mode;
+
+// A summed area table of every channel, see make_summed_area_table.
+// int w, h, c: size of the image the table was built from.
+// int pad: clamped border included on each side of the image.
+// int stride: doubles per table row, w + 2*pad + 1.
+// double *data: (h + 2*pad + 1) rows per channel, first row and column 0.
+typedef struct{
+    int w, h, c;
+    int pad;
+    int stride;
+    double *data;
+} summed_area_table;
+
+// A 3D color lookup table, see make_color_lut.
+// int n: grid points per axis.
+// float *data: output red, green and blue planes of n*n*n floats each,
+//              the entry for grid point (r, g, b) at (b*n + g)*n + r.
+typedef struct{
+    int n;
+    float *data;
+} color_lut;
+
+// A color transform to bake into a table. Changes the first three
+// channels of im in place.
+typedef void (*color_transform)(image im, void *arg);
+
+// Most operations one pointwise_expr can hold.
+#define POINTWISE_MAX_OPS 16
+
+typedef enum{
+    POINTWISE_SHIFT, POINTWISE_SCALE, POINTWISE_CLAMP, POINTWISE_ADD, POINTWISE_SUB
+} pointwise_kind;
+
+// One recorded pointwise operation.
+// int c: channel it applies to, -1 for all.
+// float v: amount to shift or scale by.
+// image operand: image to add or subtract.
+typedef struct{
+    pointwise_kind kind;
+    int c;
+    float v;
+    image operand;
+} pointwise_op;
+
+// A chain of pointwise operations, built with pointwise_begin and the
+// pointwise_ calls and run in one pass by pointwise_apply.
+typedef struct{
+    int n;
+    pointwise_op ops[POINTWISE_MAX_OPS];
+} pointwise_expr;
+
+// Threading
+void uw_set_num_threads(int n);
+int uw_get_num_threads();
+int uw_cpu_has(int features);
+
+// Scratch arena
+void *uw_arena_push(size_t bytes);
+void uw_arena_pop(void *p);
+image uw_arena_image(int w, int h, int c);
+padded_image uw_arena_image_padded(int w, int h, int c, int pad);
+void uw_arena_release();
+size_t uw_arena_allocations();
+
+// CPU features uw_cpu_has checks for, as bit flags.
+typedef enum{
+    UW_CPU_SSE2 = 1, UW_CPU_SSSE3 = 2, UW_CPU_AVX = 4, UW_CPU_AVX2 = 8, UW_CPU_F16C = 16
+} uw_cpu_feature;
+
+// How smooth_image_mode applies the Gaussian.
+typedef enum{
+    SMOOTH_AUTO, SMOOTH_FIR, SMOOTH_IIR
+} smooth_mode;
+
+// SMOOTH_AUTO switches to the recursive filter from this sigma up. Below
+// it the FIR path is about as fast and noticeably more accurate.
+#define SMOOTH_IIR_MIN_SIGMA 4
+
+// A Gaussian or Laplacian pyramid, see make_pyramid. All levels live in
+// one block.
+typedef struct{
+    int levels;
+    int laplacian;  // 1 after laplacian_pyramid, 0 after collapse_pyramid
+    image *level;   // level[0] full size, each next one half as big
+    float *data;    // the block, level 0 first
+} pyramid;
+
+// How a warp finds the source point of each output pixel, see remap.c.
+typedef enum{
+    WARP_MAP, WARP_HOMOGRAPHY, WARP_CYLINDER
+} warp_kind;
+
+typedef struct{
+    warp_kind kind;
+    int w, h;           // output size
+    float *x, *y;       // WARP_MAP: source point of every output pixel
+    double H[9];        // WARP_HOMOGRAPHY: output to source, row major
+    float dx, dy;       // WARP_HOMOGRAPHY: offset of the output pixels
+    float f;            // WARP_CYLINDER: focal length in pixels
+} warp;
+
+// Filters resample_image can resize with.
+typedef enum{
+    RESAMPLE_BILINEAR, RESAMPLE_AREA, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3
+} resample_filter;
+
 // Basic operations
 float get_pixel(image im, int x, int y, int c);
 void set_pixel(image im, int x, int y, int c, float v);
 image copy_image(image im);
+void copy_image_into(image im, image copy);
 image rgb_to_grayscale(image im);
+void rgb_to_grayscale_into(image im, image gray);
 image grayscale_to_rgb(image im, float r, float g, float b);
 void rgb_to_hsv(image im);
 void hsv_to_rgb(image im);
@@ -54,7 +207,26 @@ void clamp_image(image im);
 image get_channel(image im, int c);
 int same_image(image a, image b);
 image sub_image(image a, image b);
+void sub_image_into(image a, image b, image out);
 image add_image(image a, image b);
+void add_image_into(image a, image b, image out);
+
+// Color lookup tables
+color_lut make_color_lut(int n, color_transform f, void *arg);
+void free_color_lut(color_lut lut);
+void apply_color_lut(image im, color_lut lut);
+int save_color_lut(color_lut lut, const char *filename);
+color_lut load_color_lut(const char *filename);
+
+// Fused pointwise chains
+pointwise_expr pointwise_begin();
+void pointwise_shift(pointwise_expr *e, int c, float v);
+void pointwise_scale(pointwise_expr *e, int c, float v);
+void pointwise_clamp(pointwise_expr *e);
+void pointwise_add(pointwise_expr *e, image b);
+void pointwise_sub(pointwise_expr *e, image b);
+void pointwise_apply(const pointwise_expr *e, image im);
+void pointwise_apply_into(const pointwise_expr *e, image im, image out);
 
 // Loading and saving
 image make_image(int w, int h, int c);
@@ -62,15 +234,99 @@ image load_image(char *filename);
 void save_image(image im, const char *name);
 void save_png(image im, const char *name);
 void free_image(image im);
+image load_image_linear(char *filename);
+void save_image_linear(image im, const char *name);
+void save_png_linear(image im, const char *name);
+
+// sRGB transfer function
+float srgb_to_linear(float v);
+float linear_to_srgb(float v);
+void srgb_decode_table(float *table);
+void linear_to_srgb8_row(const float *src, unsigned char *dst, int n);
+
+// 8 bit images
+image_u8 make_image_u8(int w, int h, int c);
+image_u8 make_image_u8_layout(int w, int h, int c, image_layout layout);
+void free_image_u8(image_u8 im);
+image_u8 load_image_u8(char *filename);
+image_u8 load_image_u8_layout(char *filename, image_layout layout);
+image_u8 convert_layout_u8(image_u8 im, image_layout layout);
+void deinterleave_u8(const unsigned char *src, int n, int c, unsigned char *dst, int stride);
+void interleave_u8(const unsigned char *src, int stride, int n, int c, unsigned char *dst);
+void save_image_u8(image_u8 im, const char *name);
+void save_png_u8(image_u8 im, const char *name);
+image_u8 image_to_u8(image im);
+image u8_to_image(image_u8 im);
+image_u8 rgb_to_grayscale_u8(image_u8 im);
+image_u8 nn_resize_u8(image_u8 im, int w, int h);
+image_u8 bilinear_resize_u8(image_u8 im, int w, int h);
+image_u8 downsample2x_u8(image_u8 im);
+image_u8 upsample2x_u8(image_u8 im);
+image_u8 box_blur_u8(image_u8 im, int s);
+image_u8 add_image_u8(image_u8 a, image_u8 b);
+image_u8 sub_image_u8(image_u8 a, image_u8 b);
+void scale_image_u8(image_u8 im, int c, float v);
+
+// Half precision images
+float half_to_float(unsigned short h);
+unsigned short float_to_half(float f);
+void f16_to_float_row(const unsigned short *src, float *dst, int n);
+void float_to_f16_row(const float *src, unsigned short *dst, int n);
+image_f16 make_image_f16(int w, int h, int c);
+void free_image_f16(image_f16 im);
+image_f16 image_to_f16(image im);
+image f16_to_image(image_f16 im);
+image_f16 convolve_image_f16(image_f16 im, image filter, int preserve);
+image_f16 smooth_image_f16(image_f16 im, float sigma);
+image_f16 smooth_image_mode_f16(image_f16 im, float sigma, smooth_mode mode);
+image_f16 bilinear_resize_f16(image_f16 im, int w, int h);
+
+// Padded images
+padded_image make_image_padded(int w, int h, int c, int pad);
+void free_padded_image(padded_image p);
+void fill_border(padded_image p, border_mode mode);
+void pad_channel(image im, int c, padded_image p, int pc, border_mode mode);
+padded_image pad_image(image im, int pad, border_mode mode);
+image unpad_image(padded_image p);
 
 // Resizing
 float nn_interpolate(image im, float x, float y, int c);
 image nn_resize(image im, int w, int h);
+void nn_resize_into(image im, image out);
 float bilinear_interpolate(image im, float x, float y, int c);
 image bilinear_resize(image im, int w, int h);
+void bilinear_resize_into(image im, image out);
+image resample_image(image im, int w, int h, resample_filter filter);
+void resample_image_into(image im, image out, resample_filter filter);
+image downsample2x(image im);
+void downsample2x_into(image im, image out);
+image upsample2x(image im);
+void upsample2x_into(image im, image out);
+
+// Warping
+warp make_remap(int w, int h);
+warp homography_warp(matrix H, int w, int h, float dx, float dy);
+warp cylinder_warp(int w, int h, float f);
+warp bake_warp(warp m);
+void free_warp(warp m);
+void warp_row(warp m, int row, float *x, float *y);
+image remap_image(image im, warp m);
+void remap_image_into(image im, warp m, image out);
+
+// Pyramids
+pyramid make_pyramid(image im, int levels);
+void free_pyramid(pyramid p);
+image pyramid_level(pyramid p, int i);
+void rebuild_pyramid(pyramid p, int from);
+void laplacian_pyramid(pyramid *p);
+void collapse_pyramid(pyramid *p);
 
 // Filtering
 image convolve_image(image im, image filter, int preserve);
+void convolve_image_into(image im, image filter, int preserve, image out);
+image convolve_image_fft(image im, image filter, int preserve);
+void convolve_image_fft_into(image im, image filter, int preserve, image out);
+int convolve_image_uses_fft(image im, image filter);
 image make_box_filter(int w);
 image make_highpass_filter();
 image make_sharpen_filter();
@@ -82,12 +338,25 @@ void feature_normalize(image im);
 void l1_normalize(image im);
 void threshold_image(image im, float thresh);
 image *sobel_image(image im);
+void sobel_image_into(image im, image mag, image dir);
+image sobel_magnitude(image im);
+void sobel_magnitude_into(image im, image mag);
 image colorize_sobel(image im);
+void colorize_sobel_into(image im, image col_sobel);
 image smooth_image(image im, float sigma);
+void smooth_image_into(image im, float sigma, image s);
+image smooth_image_mode(image im, float sigma, smooth_mode mode);
+void smooth_image_mode_into(image im, float sigma, smooth_mode mode, image s);
+image smooth_image_iir(image im, float sigma);
+void smooth_image_iir_into(image im, float sigma, image s);
 
 // Harris and Stitching
 image structure_matrix(image im, float sigma);
+void structure_matrix_into(image im, float sigma, image S);
 image cornerness_response(image S);
+void cornerness_response_into(image S, image R);
+image nms_image(image im, int w);
+void nms_image_into(image im, int w, image r);
 void free_descriptors(descriptor *d, int n);
 image cylindrical_project(image im, float f);
 void mark_corners(image im, descriptor *d, int n);
@@ -99,6 +368,27 @@ match *match_descriptors(descriptor *a, int an, descriptor *b, int bn, int *mn);
 descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms, int *n);
 image panorama_image(image a, image b, float sigma, float thresh, int nms, float inlier_thresh, int iters, int cutoff);
 
+// Reductions
+double reduce_sum(const float *p, size_t n);
+void reduce_min_max(const float *p, size_t n, float *min, float *max);
+void reduce_mean_variance(const float *p, size_t n, double *mean, double *var);
+void reduce_histogram(const float *p, size_t n, int bins, float lo, float hi, int *counts);
+
+// Histograms and equalization
+void image_histogram(image im, int bins, int *counts);
+void equalize_image(image im, int c, int bins);
+void clahe_image(image im, int c, int tiles, int bins, float clip);
+
+// Integral images
+summed_area_table make_summed_area_table(image im, int pad);
+void free_summed_area_table(summed_area_table t);
+double window_sum(summed_area_table t, int x0, int y0, int x1, int y1, int c);
+image make_integral_image(image im);
+image box_filter_rect(image im, int fw, int fh);
+void box_filter_rect_into(image im, int fw, int fh, image S);
+image box_filter_image(image im, int s);
+void box_filter_image_into(image im, int s, image S);
+
 // Optical Flow
 image optical_flow_images(image im, image prev, int smooth, int stride);
 void optical_flow_webcam(int smooth, int stride, int div);
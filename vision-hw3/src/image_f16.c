@@ -0,0 +1,418 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "image.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define F16_X86
+#include <immintrin.h>
+#endif
+
+// Half precision storage for intermediates that don't need 32 bits.
+// Samples are IEEE binary16, planar like image. Nothing is computed in
+// half precision: operators decode a strip of rows to float on the scratch
+// arena, run the float kernel on it and encode the result, so the big
+// images only ever move 2 bytes per sample through memory.
+
+// Output rows per strip. A decoded strip with its halo stays in L2 for
+// the image sizes we work with. Strips run one after another; the float
+// operator threads within each.
+#define F16_STRIP 64
+
+typedef union{
+    float f;
+    unsigned int u;
+} float_bits;
+
+// Converts a half to float exactly, in software.
+float half_to_float(unsigned short h)
+{
+    float_bits b;
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exp = (h >> 10) & 0x1f;
+    unsigned int mant = h & 0x3ff;
+    if (exp == 0x1f) {
+        b.u = sign | 0x7f800000 | (mant << 13);
+    } else if (exp == 0) {
+        // Zero or subnormal, mant * 2^-24 is exact in float.
+        b.f = mant*(1.0f/16777216);
+        b.u |= sign;
+    } else {
+        b.u = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    return b.f;
+}
+
+// Converts a float to the nearest half, ties to even, in software. Gives
+// the same bits as the F16C instruction: too large rounds to infinity and
+// NaN stays NaN with the top of its payload.
+unsigned short float_to_half(float f)
+{
+    float_bits b;
+    b.f = f;
+    unsigned int sign = (b.u >> 16) & 0x8000;
+    unsigned int x = b.u & 0x7fffffff;
+    unsigned int h;
+    if (x >= 0x7f800000) {
+        h = 0x7c00 | ((x > 0x7f800000) ? 0x200 | ((x >> 13) & 0x3ff) : 0);
+    } else if (x >= 0x477ff000) {
+        // 65520 and up round past the largest half.
+        h = 0x7c00;
+    } else if (x < 0x38800000) {
+        // Below the smallest normal half: adding 0.5 lines the subnormal
+        // bits up with the bottom of the float mantissa, and the float
+        // add does the round to nearest even.
+        float_bits t;
+        t.u = x;
+        t.f += 0.5f;
+        h = t.u - 0x3f000000;
+    } else {
+        unsigned int odd = (x >> 13) & 1;
+        h = (x - 0x38000000 + 0xfff + odd) >> 13;
+    }
+    return sign | h;
+}
+
+static void f16_to_float_row_generic(const unsigned short *src, float *dst, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = half_to_float(src[i]);
+}
+
+static void float_to_f16_row_generic(const float *src, unsigned short *dst, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = float_to_half(src[i]);
+}
+
+#ifdef F16_X86
+__attribute__((target("avx,f16c")))
+static void f16_to_float_row_f16c(const unsigned short *src, float *dst, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    f16_to_float_row_generic(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx,f16c")))
+static void float_to_f16_row_f16c(const float *src, unsigned short *dst, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+    float_to_f16_row_generic(src + i, dst + i, n - i);
+}
+#endif
+
+// The row converters run once per row inside the parallel loops, so they
+// check for F16C through the cached uw_cpu_has rather than asking the CPU.
+
+// Decodes n halves to float, with F16C when the CPU has it.
+void f16_to_float_row(const unsigned short *src, float *dst, int n)
+{
+#ifdef F16_X86
+    if (uw_cpu_has(UW_CPU_F16C | UW_CPU_AVX)) {
+        f16_to_float_row_f16c(src, dst, n);
+        return;
+    }
+#endif
+    f16_to_float_row_generic(src, dst, n);
+}
+
+// Encodes n floats to the nearest halves, with F16C when the CPU has it.
+void float_to_f16_row(const float *src, unsigned short *dst, int n)
+{
+#ifdef F16_X86
+    if (uw_cpu_has(UW_CPU_F16C | UW_CPU_AVX)) {
+        float_to_f16_row_f16c(src, dst, n);
+        return;
+    }
+#endif
+    float_to_f16_row_generic(src, dst, n);
+}
+
+image_f16 make_image_f16(int w, int h, int c)
+{
+    image_f16 im;
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.data = calloc((size_t)w*h*c, sizeof(unsigned short));
+    return im;
+}
+
+void free_image_f16(image_f16 im)
+{
+    free(im.data);
+}
+
+// Converts a float image to half precision, rounding to nearest.
+image_f16 image_to_f16(image im)
+{
+    image_f16 out = make_image_f16(im.w, im.h, im.c);
+    int rows = im.h*im.c;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < rows; y++) {
+        float_to_f16_row(im.data + (size_t)y*im.w, out.data + (size_t)y*im.w, im.w);
+    }
+    return out;
+}
+
+// Converts a half precision image to float, exactly.
+image f16_to_image(image_f16 im)
+{
+    image out = make_image(im.w, im.h, im.c);
+    int rows = im.h*im.c;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < rows; y++) {
+        f16_to_float_row(im.data + (size_t)y*im.w, out.data + (size_t)y*im.w, im.w);
+    }
+    return out;
+}
+
+static inline int clamp_row(int y, int h)
+{
+    return (y < 0) ? 0 : ((y > h - 1) ? h - 1 : y);
+}
+
+// A float operator on a strip of rows. Reads in, a strip with halo rows
+// above and below, and writes out, the same strip with the same halo.
+typedef void (*strip_op)(image in, image out, const void *arg);
+
+// Runs a float operator over a half image a strip of rows at a time. Each
+// strip is decoded with halo rows on either side, repeating the edge rows
+// past the top and bottom, so an operator that clamps at the image edge
+// and reads at most that far up and down gives the same rows it would on
+// the whole image.
+// image_f16 im: input.
+// int above, below: halo rows the operator reads above and below a row.
+// strip_op op: operator, called with float strips.
+// const void *arg: passed through to op.
+// image_f16 out: output, im.w x im.h, any number of channels.
+static void apply_in_strips(image_f16 im, int above, int below,
+        strip_op op, const void *arg, image_f16 out)
+{
+    assert(out.w == im.w && out.h == im.h);
+    int w = im.w;
+    // Tall operators get taller strips, so halo rows, which are decoded
+    // and filtered once per strip they border, stay under a fifth of the
+    // rows decoded.
+    int strip = MIN(MAX(F16_STRIP, 4*(above + below)), im.h);
+    int rows = strip + above + below;
+    image in = uw_arena_image(w, rows, im.c);
+    image res = uw_arena_image(w, rows, out.c);
+    for (int y0 = 0; y0 < im.h; y0 += strip) {
+        int n = MIN(strip, im.h - y0);
+        in.h = res.h = n + above + below;
+        for (int c = 0; c < im.c; c++) {
+            for (int i = 0; i < in.h; i++) {
+                int sy = clamp_row(y0 - above + i, im.h);
+                f16_to_float_row(im.data + ((size_t)c*im.h + sy)*w,
+                        in.data + (c*in.h + i)*w, w);
+            }
+        }
+        op(in, res, arg);
+        for (int c = 0; c < out.c; c++) {
+            for (int i = 0; i < n; i++) {
+                float_to_f16_row(res.data + (c*res.h + above + i)*w,
+                        out.data + ((size_t)c*out.h + y0 + i)*w, w);
+            }
+        }
+    }
+    uw_arena_pop(in.data);
+}
+
+typedef struct{
+    image filter;
+    int preserve;
+} convolve_args;
+
+static void convolve_strip(image in, image out, const void *arg)
+{
+    const convolve_args *a = arg;
+    convolve_image_into(in, a->filter, a->preserve, out);
+}
+
+// convolve_image on a half precision image, with float arithmetic.
+// image_f16 im: image to filter.
+// image filter: filter, see convolve_image.
+// int preserve: see convolve_image.
+// returns: filtered image in half precision.
+image_f16 convolve_image_f16(image_f16 im, image filter, int preserve)
+{
+    assert(filter.c == 1 || filter.c == im.c);
+    int out_c = (preserve == 1) ? im.c : 1;
+    image_f16 out = make_image_f16(im.w, im.h, out_c);
+    image shape = {im.w, im.h, im.c, 0};
+    if (convolve_image_uses_fft(shape, filter)) {
+        // The transforms span the whole image, so strips would redo them
+        // for every strip. Decode once and convolve in one call instead.
+        image in = uw_arena_image(im.w, im.h, im.c);
+        image res = uw_arena_image(im.w, im.h, out_c);
+        f16_to_float_row(im.data, in.data, im.w*im.h*im.c);
+        convolve_image_fft_into(in, filter, preserve, res);
+        float_to_f16_row(res.data, out.data, im.w*im.h*out_c);
+        uw_arena_pop(in.data);
+        return out;
+    }
+    convolve_args a = {filter, preserve};
+    apply_in_strips(im, filter.h/2, filter.h - 1 - filter.h/2, convolve_strip, &a, out);
+    return out;
+}
+
+// Horizontal pass of the separable Gaussian over one source row.
+// float *pad: w + 2r floats of scratch.
+static void gaussian_row_f16(const unsigned short *src, int w, const float *g, int r,
+        float *pad, float *dst)
+{
+    f16_to_float_row(src, pad + r, w);
+    for (int i = 0; i < r; i++) {
+        pad[i] = pad[r];
+        pad[r + w + i] = pad[r + w - 1];
+    }
+    for (int x = 0; x < w; x++) dst[x] = 0;
+    for (int k = 0; k <= 2*r; k++) {
+        const float *p = pad + k;
+        for (int x = 0; x < w; x++) dst[x] += g[k]*p[x];
+    }
+}
+
+// Separable Gaussian over rows [y0, y1) of one half precision plane.
+// Horizontally filtered rows are kept in a ring of 2r + 1 rows, so every
+// source row is decoded and filtered once and the vertical pass reads
+// only cache resident floats.
+static void gaussian_strip_f16(const unsigned short *src, int w, int h,
+        const float *g, int r, int y0, int y1, unsigned short *dst)
+{
+    int n = 2*r + 1;
+    float *ring = uw_arena_push((size_t)n*w*sizeof(float));
+    float *pad = uw_arena_push((w + 2*r)*sizeof(float));
+    float *acc = uw_arena_push(w*sizeof(float));
+    // Source row held in each ring slot, -1 for none.
+    int *held = uw_arena_push(n*sizeof(int));
+    for (int i = 0; i < n; i++) held[i] = -1;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) acc[x] = 0;
+        for (int k = 0; k < n; k++) {
+            int sy = clamp_row(y - r + k, h);
+            float *row = ring + (size_t)(sy%n)*w;
+            if (held[sy%n] != sy) {
+                gaussian_row_f16(src + (size_t)sy*w, w, g, r, pad, row);
+                held[sy%n] = sy;
+            }
+            for (int x = 0; x < w; x++) acc[x] += g[k]*row[x];
+        }
+        float_to_f16_row(acc, dst + (size_t)y*w, w);
+    }
+    uw_arena_pop(ring);
+}
+
+// smooth_image_mode on a half precision image, with float arithmetic.
+// The separable filter streams rows through a small float ring; the
+// recursive one needs whole columns so it runs a channel at a time.
+// image_f16 im: image to smooth.
+// float sigma: std dev. for Gaussian.
+// smooth_mode mode: see smooth_image_mode_into.
+// returns: smoothed image in half precision.
+image_f16 smooth_image_mode_f16(image_f16 im, float sigma, smooth_mode mode)
+{
+    image_f16 out = make_image_f16(im.w, im.h, im.c);
+    if (mode == SMOOTH_AUTO) mode = (sigma >= SMOOTH_IIR_MIN_SIGMA) ? SMOOTH_IIR : SMOOTH_FIR;
+    if (mode == SMOOTH_FIR) {
+        // Same taps as the FIR path of smooth_image_mode_into.
+        int size = (int)round(sigma*6);
+        if (size%2 == 0) size++;
+        int r = size/2;
+        float *g = uw_arena_push(size*sizeof(float));
+        float sum = 0;
+        for (int k = 0; k < size; k++) sum += g[k] = exp(-(k - r)*(k - r)/(2*sigma*sigma));
+        for (int k = 0; k < size; k++) g[k] /= sum;
+
+        int area = im.w*im.h;
+        int strips = (im.h + F16_STRIP - 1)/F16_STRIP;
+        for (int c = 0; c < im.c; c++) {
+            #pragma omp parallel for schedule(static)
+            for (int s = 0; s < strips; s++) {
+                gaussian_strip_f16(im.data + (size_t)c*area, im.w, im.h, g, r,
+                        s*F16_STRIP, MIN((s + 1)*F16_STRIP, im.h), out.data + (size_t)c*area);
+            }
+        }
+        uw_arena_pop(g);
+        return out;
+    }
+    int size = im.w*im.h;
+    image plane = uw_arena_image(im.w, im.h, 1);
+    for (int c = 0; c < im.c; c++) {
+        f16_to_float_row(im.data + (size_t)c*size, plane.data, size);
+        smooth_image_iir_into(plane, sigma, plane);
+        float_to_f16_row(plane.data, out.data + (size_t)c*size, size);
+    }
+    uw_arena_pop(plane.data);
+    return out;
+}
+
+// smooth_image on a half precision image: the separable Gaussian at
+// every sigma.
+image_f16 smooth_image_f16(image_f16 im, float sigma)
+{
+    return smooth_image_mode_f16(im, sigma, SMOOTH_FIR);
+}
+
+// Bilinear resize of a half precision image, with float arithmetic.
+// Samples past the edge clamp to it. The two source rows an output row
+// needs are decoded once per channel and shared by the whole row.
+// image_f16 im: image to resize.
+// int w, h: output size.
+// returns: resized image in half precision.
+image_f16 bilinear_resize_f16(image_f16 im, int w, int h)
+{
+    image_f16 out = make_image_f16(w, h, im.c);
+    float a_x = (float)im.w / w;
+    float b_x = -0.5 + 0.5 * a_x;
+    float a_y = (float)im.h / h;
+    float b_y = -0.5 + 0.5 * a_y;
+
+    // Left neighbor and weight of the right neighbor for every column.
+    int *x0 = uw_arena_push(w*sizeof(int));
+    int *x1 = uw_arena_push(w*sizeof(int));
+    float *fx = uw_arena_push(w*sizeof(float));
+    for (int x = 0; x < w; x++) {
+        float sx = MIN(MAX(a_x*x + b_x, 0), im.w - 1);
+        x0[x] = (int)sx;
+        x1[x] = MIN(x0[x] + 1, im.w - 1);
+        fx[x] = sx - x0[x];
+    }
+
+    #pragma omp parallel
+    {
+        float *top = uw_arena_push(im.w*sizeof(float));
+        float *bottom = uw_arena_push(im.w*sizeof(float));
+        float *row = uw_arena_push(w*sizeof(float));
+        #pragma omp for schedule(static)
+        for (int y = 0; y < h; y++) {
+            float sy = MIN(MAX(a_y*y + b_y, 0), im.h - 1);
+            int y0 = (int)sy;
+            int y1 = MIN(y0 + 1, im.h - 1);
+            float fy = sy - y0;
+            for (int k = 0; k < im.c; k++) {
+                const unsigned short *plane = im.data + (size_t)k*im.w*im.h;
+                f16_to_float_row(plane + (size_t)y0*im.w, top, im.w);
+                f16_to_float_row(plane + (size_t)y1*im.w, bottom, im.w);
+                for (int x = 0; x < w; x++) {
+                    float t = top[x0[x]] + fx[x]*(top[x1[x]] - top[x0[x]]);
+                    float b = bottom[x0[x]] + fx[x]*(bottom[x1[x]] - bottom[x0[x]]);
+                    row[x] = t + fy*(b - t);
+                }
+                float_to_f16_row(row, out.data + ((size_t)k*h + y)*w, w);
+            }
+        }
+        uw_arena_pop(top);
+    }
+    uw_arena_pop(x0);
+    return out;
+}
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "image.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+// 8 bit counterparts of the basic float operations, for pipelines that
+// never need more than 8 bits per sample, with 0..255 standing for 0..1.
+// Images are planar like image by default; interleaved images keep the
+// layout image files use, so a decode, resize, encode pipeline never has
+// to reorder samples. Kernels accumulate in 16 bits where the sums fit,
+// and saturate instead of clamping.
+
+image_u8 make_image_u8_layout(int w, int h, int c, image_layout layout)
+{
+    image_u8 im;
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.layout = layout;
+    im.data = calloc((size_t)w*h*c, 1);
+    return im;
+}
+
+image_u8 make_image_u8(int w, int h, int c)
+{
+    return make_image_u8_layout(w, h, c, LAYOUT_PLANAR);
+}
+
+void free_image_u8(image_u8 im)
+{
+    free(im.data);
+}
+
+// Loads an image without ever expanding it to float. An alpha channel is
+// dropped like load_image does. Interleaved images keep the decoder's
+// buffer as is, planar ones are split into planes.
+// char *filename: file to load.
+// image_layout layout: layout of the result.
+// returns: the image, 8 bit.
+image_u8 load_image_u8_layout(char *filename, image_layout layout)
+{
+    int w, h, c;
+    unsigned char *data = stbi_load(filename, &w, &h, &c, 0);
+    if (!data) {
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n",
+            filename, stbi_failure_reason());
+        exit(0);
+    }
+    int size = w*h;
+    if (c == 4) {
+        // Squeeze the alpha out in place, every write lands at or before
+        // the pixel it reads.
+        for (int i = 0; i < size; i++) {
+            data[3*i] = data[4*i];
+            data[3*i + 1] = data[4*i + 1];
+            data[3*i + 2] = data[4*i + 2];
+        }
+        c = 3;
+    }
+    image_u8 im;
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.layout = LAYOUT_INTERLEAVED;
+    im.data = data;
+    if (layout == LAYOUT_INTERLEAVED) return im;
+    image_u8 planar = convert_layout_u8(im, LAYOUT_PLANAR);
+    free(data);
+    return planar;
+}
+
+image_u8 load_image_u8(char *filename)
+{
+    return load_image_u8_layout(filename, LAYOUT_PLANAR);
+}
+
+// Copies an image into the given layout.
+image_u8 convert_layout_u8(image_u8 im, image_layout layout)
+{
+    image_u8 out = make_image_u8_layout(im.w, im.h, im.c, layout);
+    int size = im.w*im.h;
+    if (im.layout == layout || im.c == 1) {
+        memcpy(out.data, im.data, (size_t)size*im.c);
+    } else if (layout == LAYOUT_PLANAR) {
+        deinterleave_u8(im.data, size, im.c, out.data, size);
+    } else {
+        interleave_u8(im.data, size, size, im.c, out.data);
+    }
+    return out;
+}
+
+static void save_image_u8_stb(image_u8 im, const char *name, int png)
+{
+    char buff[256];
+    // Interleaved images go to the encoder as they are.
+    unsigned char *data = im.data;
+    if (im.layout == LAYOUT_PLANAR && im.c > 1) {
+        data = malloc((size_t)im.w*im.h*im.c);
+        interleave_u8(im.data, im.w*im.h, im.w*im.h, im.c, data);
+    }
+    int success = 0;
+    if (png) {
+        sprintf(buff, "%s.png", name);
+        success = stbi_write_png(buff, im.w, im.h, im.c, data, im.w*im.c);
+    } else {
+        sprintf(buff, "%s.jpg", name);
+        success = stbi_write_jpg(buff, im.w, im.h, im.c, data, 100);
+    }
+    if (data != im.data) free(data);
+    if (!success) fprintf(stderr, "Failed to write image %s\n", buff);
+}
+
+void save_image_u8(image_u8 im, const char *name)
+{
+    save_image_u8_stb(im, name, 0);
+}
+
+void save_png_u8(image_u8 im, const char *name)
+{
+    save_image_u8_stb(im, name, 1);
+}
+
+// Converts a float image to planar 8 bits, rounding and saturating to 0..255.
+image_u8 image_to_u8(image im)
+{
+    image_u8 out = make_image_u8(im.w, im.h, im.c);
+    int n = im.w*im.h*im.c;
+    for (int i = 0; i < n; i++) {
+        float v = im.data[i]*255 + .5f;
+        out.data[i] = (v <= 0) ? 0 : (v >= 255) ? 255 : (unsigned char)v;
+    }
+    return out;
+}
+
+// Converts an 8 bit image of either layout to float, 0..255 becoming 0..1.
+image u8_to_image(image_u8 im)
+{
+    image out = make_image(im.w, im.h, im.c);
+    int size = im.w*im.h;
+    int step = (im.layout == LAYOUT_PLANAR) ? 1 : im.c;
+    for (int k = 0; k < im.c; k++) {
+        const unsigned char *src = im.data + ((im.layout == LAYOUT_PLANAR) ? k*size : k);
+        float *dst = out.data + k*size;
+        for (int i = 0; i < size; i++) dst[i] = src[i*step]/255.f;
+    }
+    return out;
+}
+
+// Luma with the weights rgb_to_grayscale uses, scaled to 77, 150 and 29
+// out of 256 so the weighted sum fits in 16 bits.
+image_u8 rgb_to_grayscale_u8(image_u8 im)
+{
+    assert(im.c == 3);
+    image_u8 gray = make_image_u8_layout(im.w, im.h, 1, im.layout);
+    int size = im.w*im.h;
+    if (im.layout == LAYOUT_INTERLEAVED) {
+        const unsigned char *p = im.data;
+        for (int i = 0; i < size; i++) {
+            unsigned short sum = 77*p[3*i] + 150*p[3*i + 1] + 29*p[3*i + 2] + 128;
+            gray.data[i] = sum >> 8;
+        }
+        return gray;
+    }
+    const unsigned char *r = im.data;
+    const unsigned char *g = im.data + size;
+    const unsigned char *b = im.data + 2*size;
+    for (int i = 0; i < size; i++) {
+        unsigned short sum = 77*r[i] + 150*g[i] + 29*b[i] + 128;
+        gray.data[i] = sum >> 8;
+    }
+    return gray;
+}
+
+// Same sampling as nn_resize, source pixel round((x + .5)*im.w/w - .5),
+// done in integers so ties always round up and never depend on float
+// rounding. The source column of every output column is looked up once.
+image_u8 nn_resize_u8(image_u8 im, int w, int h)
+{
+    image_u8 out = make_image_u8_layout(w, h, im.c, im.layout);
+    int *sx = malloc(w*sizeof(int));
+    for (int x = 0; x < w; x++) {
+        sx[x] = MIN((int)((2*x + 1)*(long)im.w/(2*w)), im.w - 1);
+    }
+
+    if (im.layout == LAYOUT_INTERLEAVED) {
+        int c = im.c;
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < h; y++) {
+            int sy = MIN((int)((2*y + 1)*(long)im.h/(2*h)), im.h - 1);
+            const unsigned char *src = im.data + (size_t)sy*im.w*c;
+            unsigned char *dst = out.data + (size_t)y*w*c;
+            for (int x = 0; x < w; x++) {
+                for (int k = 0; k < c; k++) dst[x*c + k] = src[sx[x]*c + k];
+            }
+        }
+        free(sx);
+        return out;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; y++) {
+        int sy = MIN((int)((2*y + 1)*(long)im.h/(2*h)), im.h - 1);
+        for (int k = 0; k < im.c; k++) {
+            const unsigned char *src = im.data + (k*im.h + sy)*im.w;
+            unsigned char *dst = out.data + (k*h + y)*w;
+            for (int x = 0; x < w; x++) dst[x] = src[sx[x]];
+        }
+    }
+    free(sx);
+    return out;
+}
+
+// bilinear_resize_u8 at any size, without the 2x kernels. Not part of the
+// public API; tests check the kernels against it through test.h.
+image_u8 bilinear_resize_u8_general(image_u8 im, int w, int h)
+{
+    image_u8 out = make_image_u8_layout(w, h, im.c, im.layout);
+    float a_x = (float)im.w / w;
+    float b_x = -0.5 + 0.5 * a_x;
+    float a_y = (float)im.h / h;
+    float b_y = -0.5 + 0.5 * a_y;
+
+    // Left neighbor and weight of the right neighbor for every column.
+    int *x0 = malloc(w*sizeof(int));
+    int *x1 = malloc(w*sizeof(int));
+    unsigned short *fx = malloc(w*sizeof(unsigned short));
+    for (int x = 0; x < w; x++) {
+        float sx = MIN(MAX(a_x*x + b_x, 0), im.w - 1);
+        x0[x] = (int)sx;
+        x1[x] = MIN(x0[x] + 1, im.w - 1);
+        fx[x] = (unsigned short)((sx - x0[x])*128 + .5f);
+    }
+
+    // Planar images are one row of one sample per pixel per channel,
+    // interleaved ones a single row of c samples per pixel.
+    int c = (im.layout == LAYOUT_PLANAR) ? 1 : im.c;
+    int planes = (im.layout == LAYOUT_PLANAR) ? im.c : 1;
+    #pragma omp parallel
+    {
+        unsigned char *top = malloc(w*c);
+        unsigned char *bottom = malloc(w*c);
+        #pragma omp for schedule(static)
+        for (int y = 0; y < h; y++) {
+            float sy = MIN(MAX(a_y*y + b_y, 0), im.h - 1);
+            int y0 = (int)sy;
+            int y1 = MIN(y0 + 1, im.h - 1);
+            unsigned short fy = (unsigned short)((sy - y0)*128 + .5f);
+            for (int k = 0; k < planes; k++) {
+                const unsigned char *r0 = im.data + ((size_t)k*im.h + y0)*im.w*c;
+                const unsigned char *r1 = im.data + ((size_t)k*im.h + y1)*im.w*c;
+                for (int x = 0; x < w; x++) {
+                    int i0 = x0[x]*c, i1 = x1[x]*c;
+                    for (int j = 0; j < c; j++) {
+                        unsigned short a = r0[i0 + j]*(128 - fx[x]) + r0[i1 + j]*fx[x] + 64;
+                        unsigned short b = r1[i0 + j]*(128 - fx[x]) + r1[i1 + j]*fx[x] + 64;
+                        top[x*c + j] = a >> 7;
+                        bottom[x*c + j] = b >> 7;
+                    }
+                }
+                unsigned char *dst = out.data + ((size_t)k*h + y)*w*c;
+                for (int x = 0; x < w*c; x++) {
+                    unsigned short v = top[x]*(128 - fy) + bottom[x]*fy + 64;
+                    dst[x] = v >> 7;
+                }
+            }
+        }
+        free(top);
+        free(bottom);
+    }
+    free(x0);
+    free(x1);
+    free(fx);
+    return out;
+}
+
+// Bilinear resize with 7 bit weights. Each pass is a 16 bit weighted sum
+// rounded back to 8 bits, so the result is within one step of exact
+// bilinear interpolation. Samples past the edge clamp to it. Exactly half
+// and twice the size go to the 2x kernels.
+image_u8 bilinear_resize_u8(image_u8 im, int w, int h)
+{
+    if (w*2 == im.w && h*2 == im.h) return downsample2x_u8(im);
+    if (w == 2*im.w && h == 2*im.h) return upsample2x_u8(im);
+    return bilinear_resize_u8_general(im, w, h);
+}
+
+// Averages every pixel over an s x s window with clamp-to-edge padding,
+// like box_filter_image. Row sums are kept in 16 bits, which holds any
+// window up to 257 wide, and a running column sum makes the cost per
+// pixel independent of s.
+// image_u8 im: image to blur.
+// int s: window size, 1 to 257.
+// returns: blurred image.
+image_u8 box_blur_u8(image_u8 im, int s)
+{
+    assert(s >= 1 && s <= 257);
+    assert(im.layout == LAYOUT_PLANAR || im.c == 1);
+    image_u8 out = make_image_u8(im.w, im.h, im.c);
+    int w = im.w, h = im.h;
+    int lo = s/2, hi = s - 1 - s/2;
+    float scale = 1.0f/(s*s);
+    unsigned short *rows = malloc((size_t)w*h*sizeof(unsigned short));
+
+    for (int k = 0; k < im.c; k++) {
+        const unsigned char *src = im.data + k*w*h;
+        unsigned char *dst = out.data + k*w*h;
+
+        // Horizontal window sums.
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < h; y++) {
+            const unsigned char *r = src + y*w;
+            unsigned short *o = rows + y*w;
+            unsigned short sum = 0;
+            for (int i = -lo; i <= hi; i++) sum += r[MIN(MAX(i, 0), w - 1)];
+            for (int x = 0; x < w; x++) {
+                o[x] = sum;
+                sum += r[MIN(x + hi + 1, w - 1)] - r[MAX(x - lo, 0)];
+            }
+        }
+
+        // Vertical running sums over the row sums, a strip of columns per
+        // task so every thread keeps its own accumulators.
+        int strip = 256;
+        #pragma omp parallel for schedule(static)
+        for (int x0 = 0; x0 < w; x0 += strip) {
+            int n = MIN(strip, w - x0);
+            unsigned int sum[256];
+            for (int x = 0; x < n; x++) sum[x] = 0;
+            for (int i = -lo; i <= hi; i++) {
+                const unsigned short *r = rows + MIN(MAX(i, 0), h - 1)*w + x0;
+                for (int x = 0; x < n; x++) sum[x] += r[x];
+            }
+            for (int y = 0; y < h; y++) {
+                unsigned char *o = dst + y*w + x0;
+                for (int x = 0; x < n; x++) o[x] = (unsigned char)(sum[x]*scale + .5f);
+                const unsigned short *add = rows + MIN(y + hi + 1, h - 1)*w + x0;
+                const unsigned short *sub = rows + MAX(y - lo, 0)*w + x0;
+                for (int x = 0; x < n; x++) sum[x] += add[x] - sub[x];
+            }
+        }
+    }
+    free(rows);
+    return out;
+}
+
+// a + b per sample, saturating at 255. Both images share a layout.
+image_u8 add_image_u8(image_u8 a, image_u8 b)
+{
+    assert(a.w == b.w && a.h == b.h && a.c == b.c && a.layout == b.layout);
+    image_u8 out = make_image_u8_layout(a.w, a.h, a.c, a.layout);
+    int n = a.w*a.h*a.c;
+    for (int i = 0; i < n; i++) {
+        unsigned short v = a.data[i] + b.data[i];
+        out.data[i] = (v > 255) ? 255 : v;
+    }
+    return out;
+}
+
+// a - b per sample, saturating at 0. Both images share a layout.
+image_u8 sub_image_u8(image_u8 a, image_u8 b)
+{
+    assert(a.w == b.w && a.h == b.h && a.c == b.c && a.layout == b.layout);
+    image_u8 out = make_image_u8_layout(a.w, a.h, a.c, a.layout);
+    int n = a.w*a.h*a.c;
+    for (int i = 0; i < n; i++) {
+        out.data[i] = (a.data[i] > b.data[i]) ? a.data[i] - b.data[i] : 0;
+    }
+    return out;
+}
+
+// Scales one channel by v in 8.8 fixed point, saturating at 255.
+// float v: factor, 0 to 255.
+void scale_image_u8(image_u8 im, int c, float v)
+{
+    assert(v >= 0 && v < 256);
+    unsigned int k = (unsigned int)(v*256 + .5f);
+    int planar = im.layout == LAYOUT_PLANAR;
+    unsigned char *p = im.data + (planar ? c*im.w*im.h : c);
+    int step = planar ? 1 : im.c;
+    int n = im.w*im.h;
+    for (int i = 0; i < n; i++) {
+        unsigned int s = (p[i*step]*k + 128) >> 8;
+        p[i*step] = (s > 255) ? 255 : s;
+    }
+}
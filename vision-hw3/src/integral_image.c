@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// Columns handled per task in the vertical prefix pass. Each task walks
+// every row of its strip, so strips are wide enough to keep the loads
+// contiguous and few enough to split well across threads.
+#define SAT_STRIP 512
+
+static inline int clamp_coord(int i, int n)
+{
+    return (i < 0) ? 0 : ((i > n - 1) ? n - 1 : i);
+}
+
+// Fills one table plane from one image plane.
+// const float *src: w x h image plane.
+// int pad: clamped border to include on each side.
+// double *plane: (w + 2*pad + 1) x (h + 2*pad + 1) output plane.
+static void sat_plane(const float *src, int w, int h, int pad, double *plane)
+{
+    int stride = w + 2*pad + 1;
+    int rows = h + 2*pad + 1;
+    memset(plane, 0, stride*sizeof(double));
+
+    // Horizontal prefix sums, column 0 stays zero.
+    #pragma omp parallel for schedule(static)
+    for (int y = 1; y < rows; y++) {
+        const float *row = src + clamp_coord(y - 1 - pad, h)*w;
+        double *out = plane + (size_t)y*stride;
+        double sum = 0;
+        *out++ = 0;
+        for (int x = 0; x < pad; x++) *out++ = (sum += row[0]);
+        for (int x = 0; x < w; x++) *out++ = (sum += row[x]);
+        for (int x = 0; x < pad; x++) *out++ = (sum += row[w - 1]);
+    }
+
+    // Vertical prefix sums, a strip of columns at a time.
+    int strips = (stride + SAT_STRIP - 1)/SAT_STRIP;
+    #pragma omp parallel for schedule(static)
+    for (int s = 0; s < strips; s++) {
+        int x0 = s*SAT_STRIP;
+        int x1 = MIN(x0 + SAT_STRIP, stride);
+        for (int y = 2; y < rows; y++) {
+            const double *above = plane + (size_t)(y - 1)*stride;
+            double *out = plane + (size_t)y*stride;
+            for (int x = x0; x < x1; x++) out[x] += above[x];
+        }
+    }
+}
+
+// Builds a summed area table of every channel. The table is accumulated in
+// double so sums over large images stay exact to well below float
+// precision. The image is first extended by pad pixels on each side with
+// its edge values, the same padding convolve_image uses, so windows that
+// hang over the edge by up to pad pixels are answered like a clamped
+// convolution would.
+// image im: image to sum.
+// int pad: width of the clamped border to include, 0 for none.
+// returns: the table, release with free_summed_area_table.
+summed_area_table make_summed_area_table(image im, int pad)
+{
+    assert(pad >= 0);
+    summed_area_table t;
+    t.w = im.w;
+    t.h = im.h;
+    t.c = im.c;
+    t.pad = pad;
+    t.stride = im.w + 2*pad + 1;
+    size_t plane = (size_t)t.stride*(im.h + 2*pad + 1);
+    t.data = malloc(plane*im.c*sizeof(double));
+    for (int c = 0; c < im.c; c++) {
+        sat_plane(im.data + c*im.w*im.h, im.w, im.h, pad, t.data + c*plane);
+    }
+    return t;
+}
+
+void free_summed_area_table(summed_area_table t)
+{
+    free(t.data);
+}
+
+// Sums one channel over the window [x0, x1) x [y0, y1) of the image.
+// Coordinates may fall outside the image; the part of the window inside
+// the padded border is summed and anything beyond it is dropped.
+// summed_area_table t: table to query.
+// int x0, y0, x1, y1: window corners, x1 and y1 exclusive.
+// int c: channel.
+// returns: sum of the pixels in the window.
+double window_sum(summed_area_table t, int x0, int y0, int x1, int y1, int c)
+{
+    int xmax = t.w + t.pad;
+    int ymax = t.h + t.pad;
+    x0 = MIN(MAX(x0, -t.pad), xmax);
+    x1 = MIN(MAX(x1, -t.pad), xmax);
+    y0 = MIN(MAX(y0, -t.pad), ymax);
+    y1 = MIN(MAX(y1, -t.pad), ymax);
+    if (x1 <= x0 || y1 <= y0) return 0;
+
+    const double *plane = t.data + (size_t)c*t.stride*(t.h + 2*t.pad + 1);
+    const double *top = plane + (size_t)(y0 + t.pad)*t.stride + t.pad;
+    const double *bottom = plane + (size_t)(y1 + t.pad)*t.stride + t.pad;
+    return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+// Make an integral image or summed area table from an image
+// image im: image to process
+// returns: image I such that I[x,y] = sum{i<=x, j<=y}(im[i,j])
+image make_integral_image(image im)
+{
+    image integ = make_image(im.w, im.h, im.c);
+    summed_area_table t = make_summed_area_table(im, 0);
+    for (int c = 0; c < im.c; c++) {
+        const double *plane = t.data + (size_t)c*t.stride*(im.h + 1);
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < im.h; y++) {
+            const double *row = plane + (size_t)(y + 1)*t.stride + 1;
+            float *out = integ.data + c*im.w*im.h + y*im.w;
+            for (int x = 0; x < im.w; x++) out[x] = row[x];
+        }
+    }
+    free_summed_area_table(t);
+    return integ;
+}
+
+// Averages every pixel over a fw x fh window with clamp-to-edge padding.
+// The result matches convolve_image with a constant filter of that size
+// and preserve set, but costs four table reads per pixel whatever the
+// window size.
+// image im: image to smooth.
+// int fw, fh: window width and height, centered like convolve_image.
+// image S: output, same size and channels as im.
+void box_filter_rect_into(image im, int fw, int fh, image S)
+{
+    assert(fw > 0 && fh > 0);
+    assert(S.w == im.w && S.h == im.h && S.c == im.c);
+    int pad = MAX((fw + 1)/2, (fh + 1)/2);
+    int stride = im.w + 2*pad + 1;
+    double scale = 1.0/((double)fw*fh);
+
+    // One plane of table at a time, reused for every channel.
+    double *plane = uw_arena_push((size_t)stride*(im.h + 2*pad + 1)*sizeof(double));
+    for (int c = 0; c < im.c; c++) {
+        sat_plane(im.data + c*im.w*im.h, im.w, im.h, pad, plane);
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < im.h; y++) {
+            // Window [x - fw/2, x - fw/2 + fw) in table coordinates.
+            const double *top = plane + (size_t)(y - fh/2 + pad)*stride + pad - fw/2;
+            const double *bottom = top + (size_t)fh*stride;
+            float *out = S.data + c*im.w*im.h + y*im.w;
+            for (int x = 0; x < im.w; x++) {
+                out[x] = (bottom[x + fw] - bottom[x] - top[x + fw] + top[x])*scale;
+            }
+        }
+    }
+    uw_arena_pop(plane);
+}
+
+image box_filter_rect(image im, int fw, int fh)
+{
+    image S = make_image(im.w, im.h, im.c);
+    box_filter_rect_into(im, fw, fh, S);
+    return S;
+}
+
+// Apply a box filter to an image using an integral image for speed
+// image im: image to smooth
+// int s: window size for box filter
+// returns: smoothed image
+image box_filter_image(image im, int s)
+{
+    return box_filter_rect(im, s, s);
+}
+
+void box_filter_image_into(image im, int s, image S)
+{
+    box_filter_rect_into(im, s, s, S);
+}
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include "image.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INTERLEAVE_X86
+#include <immintrin.h>
+#endif
+
+// Conversions between interleaved samples, as image files store them, and
+// planar ones. Three channel 8 bit data, the common case, has SSSE3
+// kernels that move 16 pixels per iteration with byte shuffles.
+
+static void deinterleave_generic(const unsigned char *src, int n, int c,
+        unsigned char *dst, int stride)
+{
+    for (int k = 0; k < c; k++) {
+        unsigned char *d = dst + (size_t)k*stride;
+        for (int i = 0; i < n; i++) d[i] = src[i*c + k];
+    }
+}
+
+static void interleave_generic(const unsigned char *src, int stride, int n, int c,
+        unsigned char *dst)
+{
+    for (int k = 0; k < c; k++) {
+        const unsigned char *s = src + (size_t)k*stride;
+        for (int i = 0; i < n; i++) dst[i*c + k] = s[i];
+    }
+}
+
+#ifdef INTERLEAVE_X86
+// Byte i of the result is byte m[i] of the input, -1 gives 0.
+#define SHUF(...) _mm_setr_epi8(__VA_ARGS__)
+
+__attribute__((target("ssse3")))
+static void deinterleave3_ssse3(const unsigned char *src, int n,
+        unsigned char *dst, int stride)
+{
+    unsigned char *r = dst, *g = dst + stride, *b = dst + 2*(size_t)stride;
+    // Where the 16 red, green and blue bytes sit in each of the three
+    // 16 byte blocks that hold 16 pixels.
+    const __m128i r0 = SHUF(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = SHUF(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = SHUF(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = SHUF(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = SHUF(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = SHUF(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i *p = (const __m128i *)(src + 3*i);
+        __m128i a = _mm_loadu_si128(p);
+        __m128i m = _mm_loadu_si128(p + 1);
+        __m128i z = _mm_loadu_si128(p + 2);
+        __m128i vr = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, r0),
+                    _mm_shuffle_epi8(m, r1)), _mm_shuffle_epi8(z, r2));
+        __m128i vg = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, g0),
+                    _mm_shuffle_epi8(m, g1)), _mm_shuffle_epi8(z, g2));
+        __m128i vb = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, b0),
+                    _mm_shuffle_epi8(m, b1)), _mm_shuffle_epi8(z, b2));
+        _mm_storeu_si128((__m128i *)(r + i), vr);
+        _mm_storeu_si128((__m128i *)(g + i), vg);
+        _mm_storeu_si128((__m128i *)(b + i), vb);
+    }
+    deinterleave_generic(src + 3*i, n - i, 3, dst + i, stride);
+}
+
+__attribute__((target("ssse3")))
+static void interleave3_ssse3(const unsigned char *src, int stride, int n,
+        unsigned char *dst)
+{
+    const unsigned char *r = src, *g = src + stride, *b = src + 2*(size_t)stride;
+    // For each 16 byte output block, where its bytes come from in the red,
+    // green and blue vectors.
+    const __m128i r0 = SHUF(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = SHUF(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i b0 = SHUF(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i r1 = SHUF(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = SHUF(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i b1 = SHUF(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i r2 = SHUF(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = SHUF(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b2 = SHUF(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i *p = (__m128i *)(dst + 3*i);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, r0),
+                        _mm_shuffle_epi8(vg, g0)), _mm_shuffle_epi8(vb, b0)));
+        _mm_storeu_si128(p + 1, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, r1),
+                        _mm_shuffle_epi8(vg, g1)), _mm_shuffle_epi8(vb, b1)));
+        _mm_storeu_si128(p + 2, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, r2),
+                        _mm_shuffle_epi8(vg, g2)), _mm_shuffle_epi8(vb, b2)));
+    }
+    interleave_generic(src + i, stride, n - i, 3, dst + 3*i);
+}
+#endif
+
+// Splits n interleaved pixels of c channels into c planes.
+// const unsigned char *src: n*c bytes, channels of a pixel adjacent.
+// unsigned char *dst: channel k of pixel i goes to dst[k*stride + i].
+// int stride: bytes between planes, at least n.
+void deinterleave_u8(const unsigned char *src, int n, int c, unsigned char *dst, int stride)
+{
+#ifdef INTERLEAVE_X86
+    if (c == 3 && uw_cpu_has(UW_CPU_SSSE3)) {
+        deinterleave3_ssse3(src, n, dst, stride);
+        return;
+    }
+#endif
+    deinterleave_generic(src, n, c, dst, stride);
+}
+
+// Merges c planes of n pixels into interleaved pixels, the inverse of
+// deinterleave_u8.
+// const unsigned char *src: channel k of pixel i at src[k*stride + i].
+// unsigned char *dst: n*c bytes.
+void interleave_u8(const unsigned char *src, int stride, int n, int c, unsigned char *dst)
+{
+#ifdef INTERLEAVE_X86
+    if (c == 3 && uw_cpu_has(UW_CPU_SSSE3)) {
+        interleave3_ssse3(src, stride, n, dst);
+        return;
+    }
+#endif
+    interleave_generic(src, stride, n, c, dst);
+}
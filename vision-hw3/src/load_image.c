@@ -26,16 +26,37 @@ image make_image(int w, int h, int c)
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-void save_image_stb(image im, const char *name, int png)
+// Color channels are the first three, or the first of a gray image. Any
+// channel after them is alpha, which is never sRGB encoded.
+static int color_channels(int c)
+{
+    return (c >= 3) ? 3 : 1;
+}
+
+// Writes an image with stb.
+// int linear: 1 if im holds linear light to encode as sRGB, 0 if it holds
+//             the encoded values already.
+static void save_image_transfer(image im, const char *name, int png, int linear)
 {
     char buff[256];
     unsigned char *data = calloc(im.w*im.h*im.c, sizeof(char));
-    int i,k;
-    for(k = 0; k < im.c; ++k){
-        for(i = 0; i < im.w*im.h; ++i){
-            data[i*im.c+k] = (unsigned char) roundf((255*im.data[i + k*im.w*im.h]));
+    // Quantize a row of every channel, then interleave the row.
+    unsigned char *row = malloc(im.w*im.c);
+    int i,j,k;
+    for(j = 0; j < im.h; ++j){
+        for(k = 0; k < im.c; ++k){
+            const float *src = im.data + k*im.w*im.h + j*im.w;
+            if(linear && k < color_channels(im.c)){
+                linear_to_srgb8_row(src, row + k*im.w, im.w);
+                continue;
+            }
+            for(i = 0; i < im.w; ++i){
+                row[k*im.w + i] = (unsigned char) roundf((255*src[i]));
+            }
         }
+        interleave_u8(row, im.w, im.w, im.c, data + j*im.w*im.c);
     }
+    free(row);
     int success = 0;
     if(png){
         sprintf(buff, "%s.png", name);
@@ -48,6 +69,11 @@ void save_image_stb(image im, const char *name, int png)
     if(!success) fprintf(stderr, "Failed to write image %s\n", buff);
 }
 
+void save_image_stb(image im, const char *name, int png)
+{
+    save_image_transfer(im, name, png, 0);
+}
+
 void save_png(image im, const char *name)
 {
     save_image_stb(im, name, 1);
@@ -58,12 +84,11 @@ void save_image(image im, const char *name)
     save_image_stb(im, name, 0);
 }
 
-// 
-// Load an image using stb
-// channels = [0..4]
-// channels > 0 forces the image to have that many channels
-//
-image load_image_stb(char *filename, int channels)
+// Loads an image with stb.
+// int channels: 0..4, more than 0 forces that many channels.
+// int linear: 1 to decode the color channels from sRGB to linear light,
+//             0 to keep the encoded values.
+static image load_image_transfer(char *filename, int channels, int linear)
 {
     int w, h, c;
     unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
@@ -74,28 +99,64 @@ image load_image_stb(char *filename, int channels)
     }
     if (channels) c = channels;
     int i,j,k;
+    // Byte to float for plain and color channels, the transfer function
+    // costs nothing more than the divide by 255 it replaces.
+    float scale[256], decode[256];
+    for(i = 0; i < 256; ++i) scale[i] = (float)i/255.;
+    if(linear) srgb_decode_table(decode);
     image im = make_image(w, h, c);
-    for(k = 0; k < c; ++k){
-        for(j = 0; j < h; ++j){
-            for(i = 0; i < w; ++i){
-                int dst_index = i + w*j + w*h*k;
-                int src_index = k + c*i + c*w*j;
-                im.data[dst_index] = (float)data[src_index]/255.;
-            }
+    // Split a row into planes with the shuffle kernel, then widen it.
+    unsigned char *row = malloc(w*c);
+    for(j = 0; j < h; ++j){
+        deinterleave_u8(data + j*w*c, w, c, row, w);
+        for(k = 0; k < c; ++k){
+            const float *table = (linear && k < color_channels(c)) ? decode : scale;
+            float *dst = im.data + k*w*h + j*w;
+            for(i = 0; i < w; ++i) dst[i] = table[row[k*w + i]];
         }
     }
+    free(row);
     //We don't like alpha channels, #YOLO
     if(im.c == 4) im.c = 3;
     free(data);
     return im;
 }
 
+// 
+// Load an image using stb
+// channels = [0..4]
+// channels > 0 forces the image to have that many channels
+//
+image load_image_stb(char *filename, int channels)
+{
+    return load_image_transfer(filename, channels, 0);
+}
+
 image load_image(char *filename)
 {
     image out = load_image_stb(filename, 0);
     return out;
 }
 
+// Loads an image into linear light, for operations that should mix light
+// rather than encoded values. Save the result with save_image_linear.
+image load_image_linear(char *filename)
+{
+    return load_image_transfer(filename, 0, 1);
+}
+
+// Saves a linear light image as an sRGB encoded jpg.
+void save_image_linear(image im, const char *name)
+{
+    save_image_transfer(im, name, 0, 1);
+}
+
+// Saves a linear light image as an sRGB encoded png.
+void save_png_linear(image im, const char *name)
+{
+    save_image_transfer(im, name, 1, 1);
+}
+
 void free_image(image im)
 {
     free(im.data);
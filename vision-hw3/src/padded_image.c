@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// Bytes every row start (pixel x = 0) is aligned to, one cache line and
+// enough for any vector load.
+#define PADDED_ALIGN 64
+#define PADDED_ALIGN_FLOATS (PADDED_ALIGN/sizeof(float))
+
+static int round_up(int n, int m)
+{
+    return (n + m - 1)/m*m;
+}
+
+// Lays out a padded image without allocating it.
+// float *base: memory for the pixels, padded_bytes(p) long.
+static padded_image padded_layout(int w, int h, int c, int pad, float *base)
+{
+    assert(pad >= 0);
+    padded_image p;
+    p.w = w;
+    p.h = h;
+    p.c = c;
+    p.pad = pad;
+    // The left border is widened to a whole number of cache lines so that
+    // x = 0 lands on an aligned address in every row.
+    int lead = round_up(pad, PADDED_ALIGN_FLOATS);
+    p.stride = round_up(lead + w + pad, PADDED_ALIGN_FLOATS);
+    p.plane = p.stride*(h + 2*pad);
+    p.base = base;
+    p.data = base ? base + pad*p.stride + lead : 0;
+    return p;
+}
+
+static size_t padded_bytes(padded_image p)
+{
+    size_t bytes = (size_t)p.plane*p.c*sizeof(float);
+    bytes = (bytes + PADDED_ALIGN - 1)/PADDED_ALIGN*PADDED_ALIGN;
+    return bytes ? bytes : PADDED_ALIGN;
+}
+
+static padded_image alloc_padded(int w, int h, int c, int pad)
+{
+    padded_image p = padded_layout(w, h, c, pad, 0);
+    return padded_layout(w, h, c, pad, aligned_alloc(PADDED_ALIGN, padded_bytes(p)));
+}
+
+// Makes a zeroed image with a border of pad pixels on every side. Row
+// starts are 64 byte aligned and the stride is a whole number of cache
+// lines, so pixel (x, y) of channel c is at data[c*plane + y*stride + x]
+// for x in [-pad, w + pad) and y in [-pad, h + pad).
+// int w, h, c: size of the image inside the border.
+// int pad: border width in pixels.
+// returns: the image, release with free_padded_image.
+padded_image make_image_padded(int w, int h, int c, int pad)
+{
+    padded_image p = alloc_padded(w, h, c, pad);
+    memset(p.base, 0, padded_bytes(p));
+    return p;
+}
+
+// Same as make_image_padded but on the calling thread's scratch arena and
+// not cleared. Release with uw_arena_pop(p.base).
+padded_image uw_arena_image_padded(int w, int h, int c, int pad)
+{
+    padded_image p = padded_layout(w, h, c, pad, 0);
+    return padded_layout(w, h, c, pad, uw_arena_push(padded_bytes(p)));
+}
+
+void free_padded_image(padded_image p)
+{
+    free(p.base);
+}
+
+// Maps a coordinate outside [0, n) back inside it.
+static int border_index(int i, int n, border_mode mode)
+{
+    if (mode == BORDER_REFLECT && n > 1) {
+        // Mirror about the edge pixels: -1 -> 1, n -> n - 2.
+        int period = 2*(n - 1);
+        i %= period;
+        if (i < 0) i += period;
+        return (i < n) ? i : period - i;
+    }
+    return (i < 0) ? 0 : ((i > n - 1) ? n - 1 : i);
+}
+
+static void fill_border_channel(padded_image p, int c, border_mode mode)
+{
+    int pad = p.pad;
+    float *plane = p.data + c*p.plane;
+    // Left and right of every interior row.
+    for (int y = 0; y < p.h; y++) {
+        float *row = plane + y*p.stride;
+        for (int x = -pad; x < 0; x++) {
+            row[x] = (mode == BORDER_ZERO) ? 0 : row[border_index(x, p.w, mode)];
+        }
+        for (int x = p.w; x < p.w + pad; x++) {
+            row[x] = (mode == BORDER_ZERO) ? 0 : row[border_index(x, p.w, mode)];
+        }
+    }
+    // Whole rows above and below, borders included.
+    for (int y = -pad; y < p.h + pad; y++) {
+        if (y >= 0 && y < p.h) continue;
+        float *row = plane + y*p.stride - pad;
+        if (mode == BORDER_ZERO) {
+            memset(row, 0, (p.w + 2*pad)*sizeof(float));
+        } else {
+            const float *from = plane + border_index(y, p.h, mode)*p.stride - pad;
+            memcpy(row, from, (p.w + 2*pad)*sizeof(float));
+        }
+    }
+}
+
+// Fills the border of a padded image from its interior.
+// padded_image p: image whose interior is already set.
+// border_mode mode: BORDER_CLAMP repeats the edge pixel, BORDER_REFLECT
+//                   mirrors about it, BORDER_ZERO writes zeros.
+void fill_border(padded_image p, border_mode mode)
+{
+    for (int c = 0; c < p.c; c++) fill_border_channel(p, c, mode);
+}
+
+// Copies one channel of an image into one channel of a padded image of the
+// same size and fills that channel's border. Lets a single padded plane be
+// reused for every channel of a bigger image.
+// image im: image to copy from.
+// int c: channel of im.
+// padded_image p: destination, im.w x im.h.
+// int pc: channel of p.
+// border_mode mode: how to fill the border, see fill_border.
+void pad_channel(image im, int c, padded_image p, int pc, border_mode mode)
+{
+    assert(p.w == im.w && p.h == im.h);
+    const float *src = im.data + c*im.w*im.h;
+    float *dst = p.data + pc*p.plane;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < im.h; y++) {
+        memcpy(dst + y*p.stride, src + y*im.w, im.w*sizeof(float));
+    }
+    fill_border_channel(p, pc, mode);
+}
+
+// Copies an image into a new padded image and fills its border.
+// image im: image to copy.
+// int pad: border width in pixels.
+// border_mode mode: how to fill the border, see fill_border.
+// returns: the padded copy, release with free_padded_image.
+padded_image pad_image(image im, int pad, border_mode mode)
+{
+    padded_image p = alloc_padded(im.w, im.h, im.c, pad);
+    for (int c = 0; c < im.c; c++) pad_channel(im, c, p, c, mode);
+    return p;
+}
+
+// Copies the interior of a padded image into a plain image.
+image unpad_image(padded_image p)
+{
+    image im = make_image(p.w, p.h, p.c);
+    for (int c = 0; c < p.c; c++) {
+        for (int y = 0; y < p.h; y++) {
+            memcpy(im.data + c*p.w*p.h + y*p.w, p.data + c*p.plane + y*p.stride,
+                    p.w*sizeof(float));
+        }
+    }
+    return im;
+}
@@ -196,6 +196,8 @@ point project_point(matrix H, point p) {
     point q = make_point(0, 0);
     q.x = res.data[0][0] / res.data[2][0];
     q.y = res.data[1][0] / res.data[2][0];
+    free_matrix(c);
+    free_matrix(res);
     return q;
 }
 
@@ -391,6 +393,7 @@ image combine_images(image a, image b, matrix H)
     
     // Paste image a into the new image offset by dx and dy.
     for(k = 0; k < a.c; ++k){
+        #pragma omp parallel for private(i) schedule(static)
         for(j = 0; j < a.h; ++j){
             for(i = 0; i < a.w; ++i){
                 set_pixel(c, i-dx, j-dy, k, get_pixel(a,i,j,k));
@@ -398,21 +401,10 @@ image combine_images(image a, image b, matrix H)
         }
     }
 
-    // TODO: Paste in image b as well.
-    // You should loop over some points in the new image (which? all?)
-    // and see if their projection from a coordinates to b coordinates falls
-    // inside of the bounds of image b. If so, use bilinear interpolation to
-    // estimate the value of b at that projection, then fill in image c.
-    for (k = 0; k < c.c; ++k) {
-        for (j = floor(MIN(c1.y,c2.y)); j < ceil(MAX(c3.y,c4.y)); ++j) {
-            for (i = floor(MIN(c1.x,c3.x)); i < ceil(MAX(c2.x,c4.x)); ++i) {
-                point bp = project_point(H,make_point(i,j));
-                if (bp.x >= 0 && bp.x < b.w && bp.y >= 0 && bp.y < b.h) {
-                    set_pixel(c,i-dx,j-dy,k,bilinear_interpolate(b,bp.x,bp.y,k));
-                } 
-            }
-        }
-    }
+    // Paste in image b: every pixel of c whose projection into b lands
+    // inside b takes b's bilinear sample there, the rest keep image a.
+    warp to_b = homography_warp(H, c.w, c.h, dx, dy);
+    remap_image_into(b, to_b, c);
 
     return c;
 }
@@ -465,7 +457,5 @@ image panorama_image(image a, image b, float sigma, float thresh, int nms, float
 // returns: image projected onto cylinder, then flattened.
 image cylindrical_project(image im, float f)
 {
-    //TODO: project image onto a cylinder
-    image c = copy_image(im);
-    return c;
+    return remap_image(im, cylinder_warp(im.w, im.h, f));
 }
@@ -0,0 +1,172 @@
+#include <assert.h>
+#include "image.h"
+
+// Chains of pointwise operations evaluated in a single pass. Each channel
+// is walked a tile at a time: the tile is loaded once, every operation in
+// the chain runs over it while it sits in L1, and it is stored once. Runs
+// of shifts and scales are folded into one multiply-add first.
+
+// Floats per tile, small enough that the tile and an operand tile stay in
+// L1 and long enough for the inner loops to vectorize well.
+#define POINTWISE_TILE 512
+
+// Starts an empty chain.
+pointwise_expr pointwise_begin()
+{
+    pointwise_expr e;
+    e.n = 0;
+    return e;
+}
+
+static void push_op(pointwise_expr *e, pointwise_kind kind, int c, float v, image operand)
+{
+    assert(e->n < POINTWISE_MAX_OPS);
+    pointwise_op *op = e->ops + e->n++;
+    op->kind = kind;
+    op->c = c;
+    op->v = v;
+    op->operand = operand;
+}
+
+// Adds v to channel c, like shift_image.
+void pointwise_shift(pointwise_expr *e, int c, float v)
+{
+    image none = {0};
+    push_op(e, POINTWISE_SHIFT, c, v, none);
+}
+
+// Multiplies channel c by v, like scale_image.
+void pointwise_scale(pointwise_expr *e, int c, float v)
+{
+    image none = {0};
+    push_op(e, POINTWISE_SCALE, c, v, none);
+}
+
+// Clamps every channel to [0, 1], like clamp_image.
+void pointwise_clamp(pointwise_expr *e)
+{
+    image none = {0};
+    push_op(e, POINTWISE_CLAMP, -1, 0, none);
+}
+
+// Adds b to every channel, like add_image. b must stay alive until the
+// chain is applied.
+void pointwise_add(pointwise_expr *e, image b)
+{
+    push_op(e, POINTWISE_ADD, -1, 0, b);
+}
+
+// Subtracts b from every channel, like sub_image.
+void pointwise_sub(pointwise_expr *e, image b)
+{
+    push_op(e, POINTWISE_SUB, -1, 0, b);
+}
+
+// The steps one channel goes through, with shifts and scales folded.
+typedef struct{
+    pointwise_kind kind;
+    float a, b;
+    const float *operand;
+} pointwise_step;
+
+// Compiles the chain for channel c of a w x h image.
+// returns: number of steps written to steps.
+static int compile_channel(const pointwise_expr *e, int c, int size, pointwise_step *steps)
+{
+    int n = 0;
+    for (int i = 0; i < e->n; i++) {
+        const pointwise_op *op = e->ops + i;
+        if (op->c >= 0 && op->c != c) continue;
+        if (op->kind == POINTWISE_SHIFT || op->kind == POINTWISE_SCALE) {
+            // x*a + b, extended by this shift or scale.
+            if (n == 0 || steps[n - 1].kind != POINTWISE_SCALE) {
+                steps[n].kind = POINTWISE_SCALE;
+                steps[n].a = 1;
+                steps[n].b = 0;
+                steps[n].operand = 0;
+                n++;
+            }
+            pointwise_step *s = steps + n - 1;
+            if (op->kind == POINTWISE_SHIFT) {
+                s->b += op->v;
+            } else {
+                s->a *= op->v;
+                s->b *= op->v;
+            }
+            continue;
+        }
+        steps[n].kind = op->kind;
+        steps[n].a = 1;
+        steps[n].b = 0;
+        steps[n].operand = op->operand.data ? op->operand.data + c*size : 0;
+        n++;
+    }
+    return n;
+}
+
+// Runs the steps over a tile of n floats starting at pixel i of the plane.
+static void run_tile(const pointwise_step *steps, int nsteps, float *restrict t, int i, int n)
+{
+    for (int s = 0; s < nsteps; s++) {
+        const pointwise_step *st = steps + s;
+        const float *restrict o = st->operand ? st->operand + i : 0;
+        float a = st->a, b = st->b;
+        switch (st->kind) {
+            case POINTWISE_SCALE:
+                for (int j = 0; j < n; j++) t[j] = t[j]*a + b;
+                break;
+            case POINTWISE_CLAMP:
+                for (int j = 0; j < n; j++) t[j] = MIN(MAX(t[j], 0), 1);
+                break;
+            case POINTWISE_ADD:
+                for (int j = 0; j < n; j++) t[j] += o[j];
+                break;
+            case POINTWISE_SUB:
+                for (int j = 0; j < n; j++) t[j] -= o[j];
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Applies a chain to an image in one pass, writing the result to out.
+// Operations run in the order they were added. Images given to add and
+// sub are read as they were before the call, even if one of them is out.
+// pointwise_expr *e: the chain.
+// image im: input.
+// image out: output, same size as im, may be im itself.
+void pointwise_apply_into(const pointwise_expr *e, image im, image out)
+{
+    assert(out.w == im.w && out.h == im.h && out.c == im.c);
+    int size = im.w*im.h;
+    for (int i = 0; i < e->n; i++) {
+        const pointwise_op *op = e->ops + i;
+        if (op->kind == POINTWISE_ADD || op->kind == POINTWISE_SUB) {
+            assert(op->operand.w == im.w && op->operand.h == im.h && op->operand.c == im.c);
+        }
+    }
+
+    for (int c = 0; c < im.c; c++) {
+        pointwise_step steps[POINTWISE_MAX_OPS];
+        int nsteps = compile_channel(e, c, size, steps);
+        const float *src = im.data + c*size;
+        float *dst = out.data + c*size;
+        int tiles = (size + POINTWISE_TILE - 1)/POINTWISE_TILE;
+        #pragma omp parallel for schedule(static)
+        for (int t = 0; t < tiles; t++) {
+            float tile[POINTWISE_TILE];
+            int i = t*POINTWISE_TILE;
+            int n = MIN(POINTWISE_TILE, size - i);
+            for (int j = 0; j < n; j++) tile[j] = src[i + j];
+            run_tile(steps, nsteps, tile, i, n);
+            for (int j = 0; j < n; j++) dst[i + j] = tile[j];
+        }
+    }
+}
+
+// Applies a chain to an image in place.
+void pointwise_apply(const pointwise_expr *e, image im)
+{
+    pointwise_apply_into(e, im, im);
+}
@@ -23,22 +23,34 @@ void set_pixel(image im, int x, int y, int c, float v)
     im.data[im.w*im.h*c + im.w*y + x] = v;
 }
 
+void copy_image_into(image im, image copy)
+{
+    assert(copy.w == im.w && copy.h == im.h && copy.c == im.c);
+    memcpy(copy.data, im.data, im.w*im.h*im.c*sizeof(float));
+}
+
 image copy_image(image im)
 {
     image copy = make_image(im.w, im.h, im.c);
-    memcpy(copy.data, im.data, im.w*im.h*im.c*sizeof(float));
+    copy_image_into(im, copy);
     return copy;
 }
 
-image rgb_to_grayscale(image im)
+void rgb_to_grayscale_into(image im, image gray)
 {
     assert(im.c == 3);
-    image gray = make_image(im.w, im.h, 1);
+    assert(gray.w == im.w && gray.h == im.h && gray.c == 1);
     int im_size = im.w*im.h;
     for (unsigned int i = 0; i < im_size; i++) {
         // gray.data[i] = (im.data[i] + im.data[i + im_size] + im.data[i + im_size*2]) / 3; // Weighted mean K = (R+G+B)/3
         gray.data[i] = 0.299*im.data[i] + 0.587*im.data[i + im_size] + 0.114*im.data[i + im_size*2]; // Weighted sum of luma
     }
+}
+
+image rgb_to_grayscale(image im)
+{
+    image gray = make_image(im.w, im.h, 1);
+    rgb_to_grayscale_into(im, gray);
     return gray;
 }
 
@@ -50,16 +62,17 @@ void shift_image(image im, int c, float v)
 	}
 }
 
+void scale_image(image im, int c, float v)
+{
+    int im_size = im.w*im.h;
+    float *p = im.data + im_size*c;
+    for (int i = 0; i < im_size; i++) p[i] *= v;
+}
+
 void clamp_image(image im)
 {
-    float pixel;
-    for (int c = 0; c < im.c; c++)
-        for (int w = 0; w < im.w; w++)
-            for (int h = 0; h < im.h; h++) {
-                pixel = get_pixel(im, w, h, c);
-                if (pixel < 0) set_pixel(im, w, h, c, 0);
-                if (pixel > 1) set_pixel(im, w, h, c, 1);
-            }
+    size_t n = (size_t)im.w*im.h*im.c;
+    for (size_t i = 0; i < n; i++) im.data[i] = MIN(MAX(im.data[i], 0), 1);
 }
 
 
@@ -74,118 +87,122 @@ float three_way_min(float a, float b, float c)
     return (a < b) ? ( (a < c) ? a : c) : ( (b < c) ? b : c) ;
 }
 
-void rgb_to_hsv(image im)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HSV_X86
+#endif
+
+// Converts n pixels of three planes from RGB to HSV in place. Every branch
+// of the textbook conversion is a select, so the loop vectorizes. Where
+// channels tie for the max, blue wins over green over red.
+static inline __attribute__((always_inline))
+void rgb_to_hsv_span(float *restrict p0, float *restrict p1, float *restrict p2, int n)
 {
-    for (int y = 0; y < im.h; y++)
-    {
-        for (int x = 0; x < im.w; x++)
-        {
-            float r = get_pixel(im, x, y, 0);
-            float g = get_pixel(im, x, y, 1);
-            float b = get_pixel(im, x, y, 2);
-
-            float v = three_way_max(r, g, b);
-            float m = three_way_min(r, g, b);
-
-            float c = v - m;
-            float s = 0;
-
-            if (v > 0)
-                s = c / v;
-
-            float h_ = 0;
-            if (c != 0)
-            {
-                if (v == r)
-                    h_ = (g - b) / c;
-                if (v == g)
-                    h_ = (b - r) / c + 2;
-                if (v == b)
-                    h_ = (r - g) / c + 4;
-            }
-            float h = h_ / 6;
-            if (h_ < 0)
-                h = h_ / 6 + 1;
-
-            set_pixel(im, x, y, 0, h);
-            set_pixel(im, x, y, 1, s);
-            set_pixel(im, x, y, 2, v);
-        }
+    for (int x = 0; x < n; x++) {
+        float r = p0[x], g = p1[x], b = p2[x];
+        float v = MAX(MAX(r, g), b);
+        float m = MIN(MIN(r, g), b);
+        float c = v - m;
+        float s = (v > 0) ? c / v : 0;
+        float ic = (c != 0) ? 1 / c : 0;
+        float h_ = (v == b) ? (r - g)*ic + 4 :
+                   (v == g) ? (b - r)*ic + 2 : (g - b)*ic;
+        h_ = (c != 0) ? h_ : 0;
+        float h = h_ / 6;
+        p0[x] = (h_ < 0) ? h + 1 : h;
+        p1[x] = s;
+        p2[x] = v;
     }
 }
 
-void hsv_to_rgb(image im)
+// Converts n pixels of three planes from HSV to RGB in place, picking the
+// hue sector with selects. Hues outside [0, 1) come out black.
+static inline __attribute__((always_inline))
+void hsv_to_rgb_span(float *restrict p0, float *restrict p1, float *restrict p2, int n)
+{
+    for (int x = 0; x < n; x++) {
+        float h = p0[x], s = p1[x], v = p2[x];
+        // Converting through int truncates like truncf for any hue in
+        // range, without the libm call truncf becomes before SSE4.1. The
+        // clamp keeps the conversion defined for huge or NaN hues and
+        // still lands them outside every sector.
+        float h6 = MIN(MAX(h * 6, -1), 6);
+        float i = (int)h6;
+        float f = h6 - i;
+        float p = v * (1 - s);
+        float q = v * (1 - s * f);
+        float t = v * (1 - s * (1 - f));
+        // One select per sector. Sectors don't overlap, so the order of
+        // the selects doesn't matter and each one is a plain blend.
+        int s0 = i == 0, s1 = i == 1, s2 = i == 2, s3 = i == 3, s4 = i == 4, s5 = i == 5;
+        float r = (s0 | s5) ? v : 0, g = s0 ? t : 0, b = (s0 | s1) ? p : 0;
+        r = s1 ? q : r;
+        g = (s1 | s2) ? v : g;
+        b = s2 ? t : b;
+        r = (s2 | s3) ? p : r;
+        g = s3 ? q : g;
+        b = (s3 | s4) ? v : b;
+        r = s4 ? t : r;
+        g = (s4 | s5) ? p : g;
+        b = s5 ? q : b;
+        p0[x] = r;
+        p1[x] = g;
+        p2[x] = b;
+    }
+}
+
+typedef void (*color_span_fn)(float *p0, float *p1, float *p2, int n);
+
+static void rgb_to_hsv_generic(float *p0, float *p1, float *p2, int n)
+{
+    rgb_to_hsv_span(p0, p1, p2, n);
+}
+
+static void hsv_to_rgb_generic(float *p0, float *p1, float *p2, int n)
+{
+    hsv_to_rgb_span(p0, p1, p2, n);
+}
+
+#ifdef HSV_X86
+__attribute__((target("avx2")))
+static void rgb_to_hsv_avx2(float *p0, float *p1, float *p2, int n)
+{
+    rgb_to_hsv_span(p0, p1, p2, n);
+}
+
+__attribute__((target("avx2")))
+static void hsv_to_rgb_avx2(float *p0, float *p1, float *p2, int n)
 {
-    for (int y = 0; y < im.h; y++)
-    {
-        for (int x = 0; x < im.w; x++)
-        {
-            float h = get_pixel(im, x, y, 0);
-            float s = get_pixel(im, x, y, 1);
-            float v = get_pixel(im, x, y, 2);
-
-            float r = 0;
-            float g = 0;
-            float b = 0;
-
-            if (s == 0)
-            {
-                r = 0;
-                b = 0;
-                g = 0;
-            }
-
-            float i = trunc(h * 6);
-            float f = (h * 6) - i;
-            float p = v * (1 - s);
-            float q = v * (1 - s * f);
-            float t = v * (1 - s * (1 - f));
-
-            if (i == 0)
-            {
-                r = v;
-                g = t;
-                b = p;
-            }
-
-            if (i == 1)
-            {
-                r = q;
-                g = v;
-                b = p;
-            }
-
-            if (i == 2)
-            {
-                r = p;
-                g = v;
-                b = t;
-            }
-
-            if (i == 3)
-            {
-                r = p;
-                g = q;
-                b = v;
-            }
-
-            if (i == 4)
-            {
-                r = t;
-                g = p;
-                b = v;
-            }
-
-            if (i == 5)
-            {
-                r = v;
-                g = p;
-                b = q;
-            }
-
-            set_pixel(im, x, y, 0, r);
-            set_pixel(im, x, y, 1, g);
-            set_pixel(im, x, y, 2, b);
-        }
+    hsv_to_rgb_span(p0, p1, p2, n);
+}
+#endif
+
+// Applies a span conversion to the first three channels, a row at a time.
+static void convert_planes(image im, color_span_fn generic, color_span_fn avx2)
+{
+    assert(im.c >= 3);
+    color_span_fn span = (avx2 && uw_cpu_has(UW_CPU_AVX2)) ? avx2 : generic;
+    int size = im.w*im.h;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < im.h; y++) {
+        float *p = im.data + y*im.w;
+        span(p, p + size, p + 2*size, im.w);
     }
 }
+
+void rgb_to_hsv(image im)
+{
+#ifdef HSV_X86
+    convert_planes(im, rgb_to_hsv_generic, rgb_to_hsv_avx2);
+#else
+    convert_planes(im, rgb_to_hsv_generic, 0);
+#endif
+}
+
+void hsv_to_rgb(image im)
+{
+#ifdef HSV_X86
+    convert_planes(im, hsv_to_rgb_generic, hsv_to_rgb_avx2);
+#else
+    convert_planes(im, hsv_to_rgb_generic, 0);
+#endif
+}
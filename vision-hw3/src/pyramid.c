@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// Gaussian and Laplacian image pyramids. Each level is the one below it
+// blurred with the 5 tap binomial [1 4 6 4 1]/16 in x and y and decimated
+// by 2, rounding sizes up. Only the samples that survive decimation are
+// ever filtered. All levels share one allocation, level 0 first.
+//
+// A Laplacian pyramid keeps at each level what the coarser level can't
+// predict, level i minus level i + 1 expanded back to its size, and the
+// coarsest level as is; collapsing it adds the expansions back exactly.
+
+static const float binomial5[5] = {1, 4, 6, 4, 1};
+
+// The size of the level above one of size n.
+static int half_size(int n)
+{
+    return (n + 1)/2;
+}
+
+// Filters one row of n samples at its even positions, [1 4 6 4 1]/16
+// clamped at the ends, into half_size(n) samples.
+static void reduce_row(const float *p, int n, float *out)
+{
+    int m = half_size(n);
+    for (int x = 0; x < m; x++) {
+        int c = 2*x;
+        if (c >= 2 && c + 2 < n) {
+            out[x] = (p[c-2] + 4*p[c-1] + 6*p[c] + 4*p[c+1] + p[c+2])*(1.f/16);
+        } else {
+            float sum = 0;
+            for (int t = -2; t <= 2; t++) {
+                sum += binomial5[t+2]*p[MIN(MAX(c + t, 0), n - 1)];
+            }
+            out[x] = sum*(1.f/16);
+        }
+    }
+}
+
+// Blurs and decimates src into dst, one level up. Columns are reduced
+// row by row into a scratch image half as wide, then every output row
+// combines the five scratch rows around its even source row.
+static void reduce_level(image src, image dst)
+{
+    image tmp = uw_arena_image(dst.w, src.h, src.c);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < src.c*src.h; r++) {
+        reduce_row(src.data + (size_t)r*src.w, src.w, tmp.data + (size_t)r*dst.w);
+    }
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dst.c*dst.h; r++) {
+        int k = r/dst.h, y = r%dst.h;
+        const float *plane = tmp.data + (size_t)k*src.h*dst.w;
+        const float *rows[5];
+        for (int t = 0; t < 5; t++) {
+            rows[t] = plane + (size_t)MIN(MAX(2*y + t - 2, 0), src.h - 1)*dst.w;
+        }
+        float *out = dst.data + (size_t)r*dst.w;
+        for (int x = 0; x < dst.w; x++) {
+            out[x] = (rows[0][x] + 4*rows[1][x] + 6*rows[2][x] + 4*rows[3][x] + rows[4][x])*(1.f/16);
+        }
+    }
+    uw_arena_pop(tmp.data);
+}
+
+// Expands one row of m samples to n, the transpose of reduce_row scaled
+// by 2: even outputs are (1 6 1)/8 of their sample and its neighbours, odd
+// ones the mean of the two samples they sit between.
+static void expand_row(const float *p, int m, float *out, int n)
+{
+    for (int x = 0; x < n; x++) {
+        int k = x/2;
+        int l = MAX(k - 1, 0), r = MIN(k + 1, m - 1);
+        out[x] = (x%2) ? .5f*(p[k] + p[r]) : (p[l] + 6*p[k] + p[r])*(1.f/8);
+    }
+}
+
+// Adds sign times coarse expanded to fine's size onto fine.
+static void expand_add(image coarse, image fine, float sign)
+{
+    image tmp = uw_arena_image(fine.w, coarse.h, coarse.c);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < coarse.c*coarse.h; r++) {
+        expand_row(coarse.data + (size_t)r*coarse.w, coarse.w, tmp.data + (size_t)r*fine.w, fine.w);
+    }
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < fine.c*fine.h; r++) {
+        int k = r/fine.h, y = r%fine.h;
+        const float *plane = tmp.data + (size_t)k*coarse.h*fine.w;
+        int j = y/2;
+        const float *a = plane + (size_t)MAX(j - 1, 0)*fine.w;
+        const float *b = plane + (size_t)j*fine.w;
+        const float *c = plane + (size_t)MIN(j + 1, coarse.h - 1)*fine.w;
+        float *out = fine.data + (size_t)r*fine.w;
+        if (y%2) {
+            for (int x = 0; x < fine.w; x++) out[x] += sign*.5f*(b[x] + c[x]);
+        } else {
+            for (int x = 0; x < fine.w; x++) out[x] += sign*(a[x] + 6*b[x] + c[x])*(1.f/8);
+        }
+    }
+    uw_arena_pop(tmp.data);
+}
+
+// Builds a Gaussian pyramid.
+// image im: level 0, copied.
+// int levels: number of levels wanted, fewer are built if the top would
+//             get smaller than a pixel.
+// returns: the pyramid, release with free_pyramid.
+pyramid make_pyramid(image im, int levels)
+{
+    assert(levels > 0);
+    pyramid p;
+    int w = im.w, h = im.h, n = 1;
+    size_t total = (size_t)w*h*im.c;
+    while (n < levels && (w > 1 || h > 1)) {
+        w = half_size(w);
+        h = half_size(h);
+        total += (size_t)w*h*im.c;
+        n++;
+    }
+    p.levels = n;
+    p.laplacian = 0;
+    p.data = malloc(total*sizeof(float));
+    p.level = malloc(n*sizeof(image));
+    w = im.w, h = im.h;
+    float *data = p.data;
+    for (int i = 0; i < n; i++) {
+        p.level[i].w = w;
+        p.level[i].h = h;
+        p.level[i].c = im.c;
+        p.level[i].data = data;
+        data += (size_t)w*h*im.c;
+        w = half_size(w);
+        h = half_size(h);
+    }
+    memcpy(p.data, im.data, (size_t)im.w*im.h*im.c*sizeof(float));
+    rebuild_pyramid(p, 0);
+    return p;
+}
+
+void free_pyramid(pyramid p)
+{
+    free(p.data);
+    free(p.level);
+}
+
+// Level i of a pyramid, 0 the finest. The image belongs to the pyramid;
+// it can be changed in place but not freed.
+image pyramid_level(pyramid p, int i)
+{
+    assert(i >= 0 && i < p.levels);
+    return p.level[i];
+}
+
+// Recomputes the levels above a level of a Gaussian pyramid from it, e.g.
+// after writing a new frame into level 0 or editing a coarse level.
+// int from: level to rebuild from, it is kept as is.
+void rebuild_pyramid(pyramid p, int from)
+{
+    assert(!p.laplacian && from >= 0 && from < p.levels);
+    for (int i = from; i + 1 < p.levels; i++) reduce_level(p.level[i], p.level[i+1]);
+}
+
+// Turns a Gaussian pyramid into a Laplacian one in place. Finest first, so
+// each level is differenced against the still Gaussian level above it.
+void laplacian_pyramid(pyramid *p)
+{
+    assert(!p->laplacian);
+    for (int i = 0; i + 1 < p->levels; i++) expand_add(p->level[i+1], p->level[i], -1);
+    p->laplacian = 1;
+}
+
+// Collapses a Laplacian pyramid back into a Gaussian one in place, coarsest
+// first. Level 0 then holds the reconstructed image.
+void collapse_pyramid(pyramid *p)
+{
+    assert(p->laplacian);
+    for (int i = p->levels - 2; i >= 0; i--) expand_add(p->level[i+1], p->level[i], 1);
+    p->laplacian = 0;
+}
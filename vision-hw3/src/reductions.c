@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+
+// Reductions over float arrays. The array is cut into fixed size blocks
+// whatever the thread count; each block is reduced with a contiguous loop
+// the compiler vectorizes, and the block partials are merged in block
+// order. Results are therefore the same for any number of threads.
+
+// Floats per block. 64 KB, so a block that is walked twice stays in L2.
+#define REDUCE_BLOCK 16384
+
+static int reduce_blocks(size_t n)
+{
+    return (int)((n + REDUCE_BLOCK - 1)/REDUCE_BLOCK);
+}
+
+// Sums a block. Float accumulators would drift by parts in 1e4 over a
+// block, so the sum is kept in double; at -Ofast the loop still
+// vectorizes into independent lanes.
+static double block_sum(const float *p, int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += p[i];
+    return sum;
+}
+
+// Sums n floats, merging block sums in double.
+// const float *p: values.
+// size_t n: how many.
+// returns: the sum.
+double reduce_sum(const float *p, size_t n)
+{
+    int blocks = reduce_blocks(n);
+    double *partial = uw_arena_push(blocks*sizeof(double));
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < blocks; b++) {
+        size_t i = (size_t)b*REDUCE_BLOCK;
+        partial[b] = block_sum(p + i, (int)MIN(REDUCE_BLOCK, n - i));
+    }
+    double sum = 0;
+    for (int b = 0; b < blocks; b++) sum += partial[b];
+    uw_arena_pop(partial);
+    return sum;
+}
+
+// Finds the smallest and largest of n floats, n at least 1.
+// float *min, *max: set to the extremes.
+void reduce_min_max(const float *p, size_t n, float *min, float *max)
+{
+    assert(n > 0);
+    int blocks = reduce_blocks(n);
+    float *partial = uw_arena_push(2*blocks*sizeof(float));
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < blocks; b++) {
+        size_t i0 = (size_t)b*REDUCE_BLOCK;
+        int m = (int)MIN(REDUCE_BLOCK, n - i0);
+        const float *q = p + i0;
+        float lo = q[0], hi = q[0];
+        for (int i = 0; i < m; i++) {
+            lo = MIN(lo, q[i]);
+            hi = MAX(hi, q[i]);
+        }
+        partial[2*b] = lo;
+        partial[2*b + 1] = hi;
+    }
+    float lo = partial[0], hi = partial[1];
+    for (int b = 1; b < blocks; b++) {
+        lo = MIN(lo, partial[2*b]);
+        hi = MAX(hi, partial[2*b + 1]);
+    }
+    uw_arena_pop(partial);
+    *min = lo;
+    *max = hi;
+}
+
+// Mean and population variance of n floats, n at least 1. Each block
+// finds its own mean and then sums squared deviations from it while the
+// block is still in cache, and blocks are combined with the parallel
+// update of Chan et al., so large offsets don't cancel the variance away.
+// double *mean, *var: set to the statistics.
+void reduce_mean_variance(const float *p, size_t n, double *mean, double *var)
+{
+    assert(n > 0);
+    int blocks = reduce_blocks(n);
+    double *partial = uw_arena_push(2*blocks*sizeof(double));
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < blocks; b++) {
+        size_t i0 = (size_t)b*REDUCE_BLOCK;
+        int m = (int)MIN(REDUCE_BLOCK, n - i0);
+        const float *q = p + i0;
+        double mu = block_sum(q, m)/m;
+        double ss = 0;
+        for (int i = 0; i < m; i++) ss += (q[i] - mu)*(q[i] - mu);
+        partial[2*b] = mu;
+        partial[2*b + 1] = ss;
+    }
+    double count = 0, mu = 0, m2 = 0;
+    for (int b = 0; b < blocks; b++) {
+        double nb = MIN(REDUCE_BLOCK, n - (size_t)b*REDUCE_BLOCK);
+        double delta = partial[2*b] - mu;
+        double total = count + nb;
+        mu += delta*nb/total;
+        m2 += partial[2*b + 1] + delta*delta*count*nb/total;
+        count = total;
+    }
+    uw_arena_pop(partial);
+    *mean = mu;
+    *var = m2/count;
+}
+
+// Counts n floats into bins equal width bins spanning [lo, hi). Values
+// below lo land in the first bin and values from hi up in the last. Each
+// thread counts into its own bins and the counts are added up at the end.
+// int bins: number of bins.
+// float lo, hi: range the bins cover.
+// int *counts: bins counts, overwritten.
+void reduce_histogram(const float *p, size_t n, int bins, float lo, float hi, int *counts)
+{
+    assert(bins > 0 && hi > lo);
+    float scale = bins/(hi - lo);
+    int blocks = reduce_blocks(n);
+    memset(counts, 0, bins*sizeof(int));
+    #pragma omp parallel
+    {
+        int *local = uw_arena_push(bins*sizeof(int));
+        memset(local, 0, bins*sizeof(int));
+        #pragma omp for schedule(static)
+        for (int b = 0; b < blocks; b++) {
+            size_t i0 = (size_t)b*REDUCE_BLOCK;
+            int m = (int)MIN(REDUCE_BLOCK, n - i0);
+            const float *q = p + i0;
+            for (int i = 0; i < m; i++) {
+                float f = (q[i] - lo)*scale;
+                int k = (f <= 0) ? 0 : (f >= bins - 1) ? bins - 1 : (int)f;
+                local[k]++;
+            }
+        }
+        #pragma omp critical
+        for (int k = 0; k < bins; k++) counts[k] += local[k];
+        uw_arena_pop(local);
+    }
+}
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include "image.h"
+
+// Geometric warps. A warp says, for every pixel of an output image, where
+// in the source image to sample. It is either a stored coordinate map or a
+// homography or cylinder whose coordinates are generated a row at a time.
+// remap_image_into walks the output rows in parallel, gets each row's
+// source coordinates, and gathers every channel with bilinear sampling.
+// Baking a generated warp into a map once pays off when the same
+// geometry is applied to every frame, as with a fixed camera rig.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REMAP_X86
+#endif
+
+// A warp that stores its coordinates.
+// int w, h: output size.
+// returns: the warp, fill in m.x and m.y, release with free_warp.
+warp make_remap(int w, int h)
+{
+    warp m = {0};
+    m.kind = WARP_MAP;
+    m.w = w;
+    m.h = h;
+    m.x = calloc((size_t)w*h, sizeof(float));
+    m.y = calloc((size_t)w*h, sizeof(float));
+    return m;
+}
+
+// A warp through a homography, generated on the fly.
+// matrix H: 3x3, maps output coordinates to source coordinates.
+// int w, h: output size.
+// float dx, dy: output pixel (i, j) is the point (i + dx, j + dy) H maps.
+warp homography_warp(matrix H, int w, int h, float dx, float dy)
+{
+    assert(H.rows == 3 && H.cols == 3);
+    warp m = {0};
+    m.kind = WARP_HOMOGRAPHY;
+    m.w = w;
+    m.h = h;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) m.H[3*i + j] = H.data[i][j];
+    }
+    m.dx = dx;
+    m.dy = dy;
+    return m;
+}
+
+// A warp that projects a flat w x h image onto a cylinder of radius f
+// pixels around the camera, generated on the fly. Output pixel (x, y) is
+// the angle (x - w/2)/f around the cylinder and the height (y - h/2)/f
+// along it.
+warp cylinder_warp(int w, int h, float f)
+{
+    assert(f > 0);
+    warp m = {0};
+    m.kind = WARP_CYLINDER;
+    m.w = w;
+    m.h = h;
+    m.f = f;
+    return m;
+}
+
+void free_warp(warp m)
+{
+    free(m.x);
+    free(m.y);
+}
+
+// Source coordinates of an output row.
+// float *x, *y: m.w coordinates each. Points with no source, e.g. behind
+//               the camera, are set far outside any image.
+void warp_row(warp m, int row, float *x, float *y)
+{
+    if (m.kind == WARP_MAP) {
+        for (int i = 0; i < m.w; i++) {
+            x[i] = m.x[(size_t)row*m.w + i];
+            y[i] = m.y[(size_t)row*m.w + i];
+        }
+    } else if (m.kind == WARP_HOMOGRAPHY) {
+        const double *H = m.H;
+        double v = row + m.dy;
+        for (int i = 0; i < m.w; i++) {
+            double u = i + m.dx;
+            double z = H[6]*u + H[7]*v + H[8];
+            int ok = z > 1e-12 || z < -1e-12;
+            x[i] = ok ? (H[0]*u + H[1]*v + H[2])/z : -1e30;
+            y[i] = ok ? (H[3]*u + H[4]*v + H[5])/z : -1e30;
+        }
+    } else {
+        float xc = m.w/2.f, yc = m.h/2.f;
+        float hy = (row - yc)/m.f;
+        for (int i = 0; i < m.w; i++) {
+            float theta = (i - xc)/m.f;
+            float z = cosf(theta);
+            int ok = z > 1e-6f;
+            x[i] = ok ? m.f*sinf(theta)/z + xc : -1e30f;
+            y[i] = ok ? m.f*hy/z + yc : -1e30f;
+        }
+    }
+}
+
+// Turns any warp into a stored map, so its coordinates are computed once
+// however many images it is applied to.
+// returns: a WARP_MAP warp, release with free_warp.
+warp bake_warp(warp m)
+{
+    warp b = make_remap(m.w, m.h);
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < m.h; j++) {
+        warp_row(m, j, b.x + (size_t)j*m.w, b.y + (size_t)j*m.w);
+    }
+    return b;
+}
+
+// Samples one channel at n points bilinearly, clamping at the edges.
+// Points outside [0, w) x [0, h) leave their output untouched. The gather
+// uses computed indices and selects only, so the loop vectorizes into
+// gathers where the target has them.
+static inline __attribute__((always_inline))
+void remap_span(const float *restrict src, int w, int h,
+        const float *restrict x, const float *restrict y, float *restrict out, int n)
+{
+    for (int i = 0; i < n; i++) {
+        float sx = x[i], sy = y[i];
+        int inside = sx >= 0 && sx < w && sy >= 0 && sy < h;
+        sx = inside ? sx : 0;
+        sy = inside ? sy : 0;
+        int x0 = (int)sx, y0 = (int)sy;
+        int x1 = MIN(x0 + 1, w - 1), y1 = MIN(y0 + 1, h - 1);
+        float fx = sx - x0, fy = sy - y0;
+        float v00 = src[y0*w + x0], v01 = src[y0*w + x1];
+        float v10 = src[y1*w + x0], v11 = src[y1*w + x1];
+        float top = v00 + fx*(v01 - v00);
+        float bot = v10 + fx*(v11 - v10);
+        float v = top + fy*(bot - top);
+        out[i] = inside ? v : out[i];
+    }
+}
+
+typedef void (*remap_span_fn)(const float *src, int w, int h,
+        const float *x, const float *y, float *out, int n);
+
+static void remap_generic(const float *src, int w, int h,
+        const float *x, const float *y, float *out, int n)
+{
+    remap_span(src, w, h, x, y, out, n);
+}
+
+#ifdef REMAP_X86
+__attribute__((target("avx2")))
+static void remap_avx2(const float *src, int w, int h,
+        const float *x, const float *y, float *out, int n)
+{
+    remap_span(src, w, h, x, y, out, n);
+}
+#endif
+
+static remap_span_fn best_remap_span()
+{
+#ifdef REMAP_X86
+    if (uw_cpu_has(UW_CPU_AVX2)) return remap_avx2;
+#endif
+    return remap_generic;
+}
+
+// Warps an image into an existing one. Output pixels whose source point
+// falls outside im keep their values, so a warped image can be pasted over
+// another.
+// image im: source.
+// warp m: where each output pixel samples im.
+// image out: m.w x m.h, im.c channels.
+void remap_image_into(image im, warp m, image out)
+{
+    assert(out.w == m.w && out.h == m.h && out.c == im.c);
+    remap_span_fn span = best_remap_span();
+    size_t size = (size_t)im.w*im.h;
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < out.h; j++) {
+        // A stored map is read in place, generated rows go to scratch.
+        float *buf = 0;
+        const float *x, *y;
+        if (m.kind == WARP_MAP) {
+            x = m.x + (size_t)j*out.w;
+            y = m.y + (size_t)j*out.w;
+        } else {
+            buf = uw_arena_push(2*out.w*sizeof(float));
+            warp_row(m, j, buf, buf + out.w);
+            x = buf;
+            y = buf + out.w;
+        }
+        for (int k = 0; k < im.c; k++) {
+            span(im.data + k*size, im.w, im.h, x, y,
+                    out.data + ((size_t)k*out.h + j)*out.w, out.w);
+        }
+        if (buf) uw_arena_pop(buf);
+    }
+}
+
+// Warps an image. Output pixels with no source point in im are 0.
+image remap_image(image im, warp m)
+{
+    image out = make_image(m.w, m.h, im.c);
+    remap_image_into(im, m, out);
+    return out;
+}
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "image.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESIZE2X_X86
+#include <immintrin.h>
+#endif
+
+// Halving and doubling, the most common resizes. Both are what
+// bilinear_resize computes at exactly half or twice the size: halving
+// samples between every 2 x 2 block, so it is the block's mean, and
+// doubling blends each sample 3:1 with its neighbour on the side of the
+// new sample. With the weights fixed, rows are processed with SIMD kernels
+// that keep up with memory. bilinear_resize and bilinear_resize_u8 switch
+// to them by themselves when the sizes fit.
+
+// Averages 2 x 2 blocks of rows r0 and r1 into n outputs, from x on.
+static void down_row_generic(const float *r0, const float *r1, float *dst, int x, int n)
+{
+    for (; x < n; x++) dst[x] = .25f*(r0[2*x] + r0[2*x + 1] + r1[2*x] + r1[2*x + 1]);
+}
+
+// Doubles row v of n samples into 2n, from sample x up to sample end.
+static void up_row_generic(const float *v, int n, float *dst, int x, int end)
+{
+    for (; x < end; x++) {
+        float l = v[MAX(x - 1, 0)], r = v[MIN(x + 1, n - 1)];
+        dst[2*x] = .75f*v[x] + .25f*l;
+        dst[2*x + 1] = .75f*v[x] + .25f*r;
+    }
+}
+
+#ifdef RESIZE2X_X86
+__attribute__((target("avx2")))
+static void down_row_avx2(const float *r0, const float *r1, float *dst, int n)
+{
+    const __m256 quarter = _mm256_set1_ps(.25f);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256 s0 = _mm256_add_ps(_mm256_loadu_ps(r0 + 2*x), _mm256_loadu_ps(r1 + 2*x));
+        __m256 s1 = _mm256_add_ps(_mm256_loadu_ps(r0 + 2*x + 8), _mm256_loadu_ps(r1 + 2*x + 8));
+        // Pair sums come out lane by lane, put them back in order.
+        __m256 h = _mm256_hadd_ps(s0, s1);
+        h = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(dst + x, _mm256_mul_ps(h, quarter));
+    }
+    down_row_generic(r0, r1, dst, x, n);
+}
+
+__attribute__((target("avx2")))
+static void up_row_avx2(const float *v, int n, float *dst)
+{
+    const __m256 a = _mm256_set1_ps(.75f), b = _mm256_set1_ps(.25f);
+    up_row_generic(v, n, dst, 0, MIN(1, n));
+    int x = 1;
+    for (; x + 9 <= n; x += 8) {
+        __m256 c = _mm256_loadu_ps(v + x);
+        __m256 e = _mm256_add_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, _mm256_loadu_ps(v + x - 1)));
+        __m256 o = _mm256_add_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, _mm256_loadu_ps(v + x + 1)));
+        __m256 lo = _mm256_unpacklo_ps(e, o);
+        __m256 hi = _mm256_unpackhi_ps(e, o);
+        _mm256_storeu_ps(dst + 2*x, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 2*x + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    up_row_generic(v, n, dst, x, n);
+}
+#endif
+
+// Halves an image into an existing one, each output pixel the mean of a
+// 2 x 2 block. An odd last column or row is left out.
+// image out: im.w/2 x im.h/2, im.c channels.
+void downsample2x_into(image im, image out)
+{
+    assert(out.w == im.w/2 && out.h == im.h/2 && out.c == im.c);
+    int avx2 = uw_cpu_has(UW_CPU_AVX2);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < out.c*out.h; r++) {
+        int k = r/out.h, y = r%out.h;
+        const float *r0 = im.data + ((size_t)k*im.h + 2*y)*im.w;
+        const float *r1 = r0 + im.w;
+        float *dst = out.data + (size_t)r*out.w;
+#ifdef RESIZE2X_X86
+        if (avx2) {
+            down_row_avx2(r0, r1, dst, out.w);
+            continue;
+        }
+#endif
+        (void)avx2;
+        down_row_generic(r0, r1, dst, 0, out.w);
+    }
+}
+
+image downsample2x(image im)
+{
+    image out = make_image(im.w/2, im.h/2, im.c);
+    downsample2x_into(im, out);
+    return out;
+}
+
+// Doubles an image into an existing one, the same as bilinear_resize to
+// twice the size. Each output row blends two source rows 3:1, then
+// doubles the blended row.
+// image out: 2*im.w x 2*im.h, im.c channels.
+void upsample2x_into(image im, image out)
+{
+    assert(out.w == 2*im.w && out.h == 2*im.h && out.c == im.c);
+    int avx2 = uw_cpu_has(UW_CPU_AVX2);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < out.c*out.h; r++) {
+        int k = r/out.h, y = r%out.h;
+        int j = y/2, n = (y%2) ? MIN(j + 1, im.h - 1) : MAX(j - 1, 0);
+        const float *a = im.data + ((size_t)k*im.h + j)*im.w;
+        const float *b = im.data + ((size_t)k*im.h + n)*im.w;
+        float *v = uw_arena_push(im.w*sizeof(float));
+        for (int x = 0; x < im.w; x++) v[x] = .75f*a[x] + .25f*b[x];
+        float *dst = out.data + (size_t)r*out.w;
+#ifdef RESIZE2X_X86
+        if (avx2) up_row_avx2(v, im.w, dst);
+        else up_row_generic(v, im.w, dst, 0, im.w);
+#else
+        (void)avx2;
+        up_row_generic(v, im.w, dst, 0, im.w);
+#endif
+        uw_arena_pop(v);
+    }
+}
+
+image upsample2x(image im)
+{
+    image out = make_image(2*im.w, 2*im.h, im.c);
+    upsample2x_into(im, out);
+    return out;
+}
+
+// 8 bit kernels. A row holds n pixels of c interleaved samples; planar
+// images are rows with c = 1. Doubling rounds exactly like
+// bilinear_resize_u8; halving rounds the block mean once where
+// bilinear_resize_u8 rounds twice, so it can come out one step apart.
+
+static void down_row_u8_generic(const unsigned char *r0, const unsigned char *r1,
+        unsigned char *dst, int c, int x, int n)
+{
+    for (; x < n; x++) {
+        for (int k = 0; k < c; k++) {
+            int i = 2*x*c + k;
+            dst[x*c + k] = (r0[i] + r0[i + c] + r1[i] + r1[i + c] + 2) >> 2;
+        }
+    }
+}
+
+// Doubles a row of n pixels, from pixel x up to pixel end.
+static void up_row_u8_generic(const unsigned char *v, int n, int c,
+        unsigned char *dst, int x, int end)
+{
+    for (; x < end; x++) {
+        int l = MAX(x - 1, 0), r = MIN(x + 1, n - 1);
+        for (int k = 0; k < c; k++) {
+            int m = 3*v[x*c + k];
+            dst[2*x*c + k] = (m + v[l*c + k] + 2) >> 2;
+            dst[(2*x + 1)*c + k] = (m + v[r*c + k] + 2) >> 2;
+        }
+    }
+}
+
+#ifdef RESIZE2X_X86
+__attribute__((target("ssse3")))
+static void down_row_u8_ssse3(const unsigned char *r0, const unsigned char *r1,
+        unsigned char *dst, int n)
+{
+    const __m128i ones = _mm_set1_epi8(1), two = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        // Pair sums of each row in 16 bits, then the block sums.
+        __m128i lo = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(r0 + 2*x)), ones),
+                _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(r1 + 2*x)), ones));
+        __m128i hi = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(r0 + 2*x + 16)), ones),
+                _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(r1 + 2*x + 16)), ones));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    down_row_u8_generic(r0, r1, dst, 1, x, n);
+}
+
+// (3a + b + 2) >> 2 for 8 bytes widened to 16 bits.
+static inline __attribute__((always_inline)) __m128i blend31_u8(__m128i a, __m128i b)
+{
+    __m128i m = _mm_add_epi16(_mm_add_epi16(a, a), a);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(m, b), _mm_set1_epi16(2)), 2);
+}
+
+__attribute__((target("ssse3")))
+static void up_row_u8_ssse3(const unsigned char *v, int n, unsigned char *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    up_row_u8_generic(v, n, 1, dst, 0, MIN(1, n));
+    int x = 1;
+    for (; x + 17 <= n; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(v + x));
+        __m128i l = _mm_loadu_si128((const __m128i *)(v + x - 1));
+        __m128i r = _mm_loadu_si128((const __m128i *)(v + x + 1));
+        __m128i e = _mm_packus_epi16(
+                blend31_u8(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(l, zero)),
+                blend31_u8(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(l, zero)));
+        __m128i o = _mm_packus_epi16(
+                blend31_u8(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(r, zero)),
+                blend31_u8(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(r, zero)));
+        _mm_storeu_si128((__m128i *)(dst + 2*x), _mm_unpacklo_epi8(e, o));
+        _mm_storeu_si128((__m128i *)(dst + 2*x + 16), _mm_unpackhi_epi8(e, o));
+    }
+    up_row_u8_generic(v, n, 1, dst, x, n);
+}
+#endif
+
+// Halves an 8 bit image of either layout, each output pixel the rounded
+// mean of a 2 x 2 block. An odd last column or row is left out.
+image_u8 downsample2x_u8(image_u8 im)
+{
+    int w = im.w/2, h = im.h/2;
+    image_u8 out = make_image_u8_layout(w, h, im.c, im.layout);
+    int c = (im.layout == LAYOUT_PLANAR) ? 1 : im.c;
+    int planes = (im.layout == LAYOUT_PLANAR) ? im.c : 1;
+    int ssse3 = uw_cpu_has(UW_CPU_SSSE3);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < planes*h; r++) {
+        int k = r/h, y = r%h;
+        const unsigned char *r0 = im.data + ((size_t)k*im.h + 2*y)*im.w*c;
+        const unsigned char *r1 = r0 + (size_t)im.w*c;
+        unsigned char *dst = out.data + (size_t)r*w*c;
+#ifdef RESIZE2X_X86
+        if (ssse3 && c == 1) {
+            down_row_u8_ssse3(r0, r1, dst, w);
+            continue;
+        }
+#endif
+        (void)ssse3;
+        down_row_u8_generic(r0, r1, dst, c, 0, w);
+    }
+    return out;
+}
+
+// Doubles an 8 bit image of either layout, the same as
+// bilinear_resize_u8 to twice the size.
+image_u8 upsample2x_u8(image_u8 im)
+{
+    int w = 2*im.w, h = 2*im.h;
+    image_u8 out = make_image_u8_layout(w, h, im.c, im.layout);
+    int c = (im.layout == LAYOUT_PLANAR) ? 1 : im.c;
+    int planes = (im.layout == LAYOUT_PLANAR) ? im.c : 1;
+    size_t row = (size_t)w*c;
+    int ssse3 = uw_cpu_has(UW_CPU_SSSE3);
+    // Rows are doubled first, like bilinear_resize_u8 does, then source
+    // row j and its neighbours give output rows 2j and 2j + 1.
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < planes*im.h; r++) {
+        int k = r/im.h, j = r%im.h;
+        const unsigned char *src[3];
+        src[0] = im.data + ((size_t)k*im.h + MAX(j - 1, 0))*im.w*c;
+        src[1] = im.data + ((size_t)k*im.h + j)*im.w*c;
+        src[2] = im.data + ((size_t)k*im.h + MIN(j + 1, im.h - 1))*im.w*c;
+        unsigned char *up = uw_arena_push(3*row);
+        for (int t = 0; t < 3; t++) {
+#ifdef RESIZE2X_X86
+            if (ssse3 && c == 1) {
+                up_row_u8_ssse3(src[t], im.w, up + t*row);
+                continue;
+            }
+#endif
+            (void)ssse3;
+            up_row_u8_generic(src[t], im.w, c, up + t*row, 0, im.w);
+        }
+        unsigned char *d0 = out.data + ((size_t)k*h + 2*j)*row;
+        unsigned char *d1 = d0 + row;
+        const unsigned char *l = up, *m = up + row, *n = up + 2*row;
+        for (size_t x = 0; x < row; x++) {
+            d0[x] = (3*m[x] + l[x] + 2) >> 2;
+            d1[x] = (3*m[x] + n[x] + 2) >> 2;
+        }
+        uw_arena_pop(up);
+    }
+    return out;
+}
@@ -1,4 +1,6 @@
+#include <stdlib.h>
 #include <math.h>
+#include <assert.h>
 #include "image.h"
 
 float nn_interpolate(image im, float x, float y, int c)
@@ -6,60 +8,261 @@ float nn_interpolate(image im, float x, float y, int c)
     return get_pixel(im, round(x), round(y), c);
 }
 
-image nn_resize(image im, int w, int h)
+// Nearest neighbor at exactly half or twice the size. Halving picks the
+// odd samples, round(2x + .5) = 2x + 1, and doubling repeats every sample,
+// both as nn_resize_into would but without the per pixel rounding.
+// returns: 1 if the sizes fit and out was filled, 0 if not.
+static int nn_resize2x(image im, image out)
 {
-	image resized_image = make_image(w, h, im.c);
+    int half = out.w*2 == im.w && out.h*2 == im.h;
+    int twice = out.w == 2*im.w && out.h == 2*im.h;
+    if (!half && !twice) return 0;
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < out.c*out.h; r++) {
+        int k = r/out.h, y = r%out.h;
+        float *dst = out.data + (size_t)r*out.w;
+        if (half) {
+            const float *src = im.data + ((size_t)k*im.h + 2*y + 1)*im.w;
+            for (int x = 0; x < out.w; x++) dst[x] = src[2*x + 1];
+        } else {
+            const float *src = im.data + ((size_t)k*im.h + y/2)*im.w;
+            for (int x = 0; x < out.w; x++) dst[x] = src[x/2];
+        }
+    }
+    return 1;
+}
+
+// Nearest neighbor resize into an existing image.
+// image out: output, its size is the size to resize to, im.c channels.
+void nn_resize_into(image im, image out)
+{
+	assert(out.c == im.c);
+	if (nn_resize2x(im, out)) return;
+	int w = out.w, h = out.h;
 
 	float a_x = (float)im.w / (float)w;
     float b_x = -0.5 + 0.5 * a_x;
     float a_y = (float)im.h / (float)h;
     float b_y = -0.5 + 0.5 * a_y;
 
+	#pragma omp parallel for schedule(static)
 	for (unsigned int i = 0; i < h; i++) {
 		for (unsigned int j = 0; j < w; j++) {
-			set_pixel(resized_image, j, i, 0, nn_interpolate(im, (a_x*j + b_x), (a_y*i + b_y), 0));
-			set_pixel(resized_image, j, i, 1, nn_interpolate(im, (a_x*j + b_x), (a_y*i + b_y), 1));
-			set_pixel(resized_image, j, i, 2, nn_interpolate(im, (a_x*j + b_x), (a_y*i + b_y), 2));
+			for (int c = 0; c < im.c; c++) {
+				set_pixel(out, j, i, c, nn_interpolate(im, (a_x*j + b_x), (a_y*i + b_y), c));
+			}
 		}
 	}
+}
+
+image nn_resize(image im, int w, int h)
+{
+	image resized_image = make_image(w, h, im.c);
+	nn_resize_into(im, resized_image);
     return resized_image;
 }
 
 float bilinear_interpolate(image im, float x, float y, int c)
 {
-	float v1 = get_pixel(im, floorf(x), floorf(y), c);
-   	float v2 = get_pixel(im, floorf(x), ceilf(y), c);
-   	float v3 = get_pixel(im, ceilf(x), floorf(y), c);
-   	float v4 = get_pixel(im, ceilf(x) + 1, ceilf(y), c);
-   	float d1 = y - floorf(y);
-   	float d2 = ceilf(y) - y;
-   	float d3 = x - floorf(x);
-   	float d4 = ceilf(x) - x;
-   	float q1 = v1 * d2 + v2 * d1;
-   	float q2 = v3 * d2 + v4 * d1;
-   	return q1 * d4 + q2 * d3;
+    float x0 = floorf(x), y0 = floorf(y);
+    float dx = x - x0, dy = y - y0;
+    float v1 = get_pixel(im, x0, y0, c);
+    float v2 = get_pixel(im, x0 + 1, y0, c);
+    float v3 = get_pixel(im, x0, y0 + 1, c);
+    float v4 = get_pixel(im, x0 + 1, y0 + 1, c);
+    float top = v1 + dx*(v2 - v1);
+    float bot = v3 + dx*(v4 - v3);
+    return top + dy*(bot - top);
 }
 
-image bilinear_resize(image im, int w, int h)
+// Separable resampling. Every output column (or row) is a weighted sum of
+// a short run of input columns (rows). The runs and weights only depend on
+// the two sizes and the filter, so they are worked out once per axis on
+// the scratch arena, and the image is resampled in a horizontal pass over
+// each row followed by a vertical pass that combines whole rows, both over
+// contiguous memory.
+//
+// When shrinking, the antialiased filters stretch over the footprint of an
+// output sample in the input: a 7x reduction averages about 7 input
+// samples per tap side instead of reading 2 of them and skipping the rest.
+
+// Where each output sample along one axis reads from.
+typedef struct{
+    int taps;       // input samples per output sample
+    int *start;     // first input sample of each output sample
+    float *weights; // taps weights per output sample, summing to 1
+} resample_axis;
+
+static double sinc(double x)
 {
-    image resized_image = make_image(w, h, im.c);
+    if (fabs(x) < 1e-8) return 1;
+    x *= M_PI;
+    return sin(x)/x;
+}
 
-	float a_x = (float)im.w / (float)w;
-    float b_x = -0.5 + 0.5 * a_x;
-    float a_y = (float)im.h / (float)h;
-    float b_y = -0.5 + 0.5 * a_y;
-	float newX, newY;
+// How far from an output sample's position, in input samples, a filter
+// stretched by f reaches.
+static double filter_reach(resample_filter filter, double f)
+{
+    switch (filter) {
+        case RESAMPLE_AREA: return (f + 1)/2;
+        case RESAMPLE_BICUBIC: return 2*f;
+        case RESAMPLE_LANCZOS3: return 3*f;
+        default: return f;
+    }
+}
 
-	for (unsigned int i = 0; i < h; i++) {
-		for (unsigned int j = 0; j < w; j++) {
-			newX = (a_x*j + b_x);
-			newY = (a_y*i + b_y);
+// Unnormalized weight of the input sample d away from an output sample's
+// position, for a filter stretched by f.
+static double filter_weight(resample_filter filter, double d, double f)
+{
+    double x = fabs(d)/f;
+    switch (filter) {
+        case RESAMPLE_AREA:
+            // Overlap of the input pixel with the output pixel's footprint.
+            return MAX(MIN(.5, d + f/2) - MAX(-.5, d - f/2), 0);
+        case RESAMPLE_BICUBIC:
+            // Keys' cubic with a = -0.5, the Catmull-Rom spline.
+            if (x < 1) return (1.5*x - 2.5)*x*x + 1;
+            if (x < 2) return ((-.5*x + 2.5)*x - 4)*x + 2;
+            return 0;
+        case RESAMPLE_LANCZOS3:
+            return (x < 3) ? sinc(x)*sinc(x/3) : 0;
+        default:
+            return (x < 1) ? 1 - x : 0;
+    }
+}
 
-			set_pixel(resized_image, j, i, 0, bilinear_interpolate(im, newX, newY, 0));
-			set_pixel(resized_image, j, i, 1, bilinear_interpolate(im, newX, newY, 1));
-			set_pixel(resized_image, j, i, 2, bilinear_interpolate(im, newX, newY, 2));
-		}
-	}
+// Works out the weights for resampling in samples to out. Output sample i
+// sits at input position (i + .5)*in/out - .5. Taps that fall off either
+// end are folded onto the edge sample, which is clamping the image.
+// The tables live on the scratch arena, release them with
+// uw_arena_pop(a.start).
+// int antialias: 1 to stretch the filter by in/out when shrinking.
+static resample_axis make_resample_axis(int in, int out, resample_filter filter, int antialias)
+{
+    resample_axis a;
+    double scale = (double)in/out;
+    double f = antialias ? MAX(scale, 1) : 1;
+    double r = filter_reach(filter, f);
+    int window = 2*(int)ceil(r);
+    a.taps = MIN(window, in);
+    a.start = uw_arena_push(out*sizeof(int));
+    a.weights = uw_arena_push((size_t)out*a.taps*sizeof(float));
+    double *w = uw_arena_push(window*sizeof(double));
+    for (int i = 0; i < out; i++) {
+        double s = (i + .5)*scale - .5;
+        int first = (int)floor(s - r) + 1;
+        int start = MIN(MAX(first, 0), in - a.taps);
+        double sum = 0;
+        for (int t = 0; t < window; t++) {
+            w[t] = filter_weight(filter, s - (first + t), f);
+            sum += w[t];
+        }
+        float *wt = a.weights + (size_t)i*a.taps;
+        for (int t = 0; t < a.taps; t++) wt[t] = 0;
+        for (int t = 0; t < window; t++) {
+            int j = MIN(MAX(first + t, 0), in - 1);
+            wt[j - start] += w[t]/sum;
+        }
+        a.start[i] = start;
+    }
+    uw_arena_pop(w);
+    return a;
+}
+
+// Resamples every channel of im into out, columns through ax and rows
+// through ay.
+static void resample_separable(image im, image out, resample_axis ax, resample_axis ay)
+{
+    image tmp = uw_arena_image(out.w, im.h, im.c);
+
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < im.c*im.h; r++) {
+        const float *src = im.data + (size_t)r*im.w;
+        float *dst = tmp.data + (size_t)r*out.w;
+        if (ax.taps == 2) {
+            // The bilinear case, with the tap loop unrolled.
+            for (int x = 0; x < out.w; x++) {
+                const float *p = src + ax.start[x];
+                const float *wt = ax.weights + 2*x;
+                dst[x] = wt[0]*p[0] + wt[1]*p[1];
+            }
+            continue;
+        }
+        for (int x = 0; x < out.w; x++) {
+            const float *p = src + ax.start[x];
+            const float *wt = ax.weights + (size_t)x*ax.taps;
+            float sum = 0;
+            for (int t = 0; t < ax.taps; t++) sum += wt[t]*p[t];
+            dst[x] = sum;
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < out.c*out.h; r++) {
+        int k = r/out.h, y = r%out.h;
+        const float *src = tmp.data + ((size_t)k*im.h + ay.start[y])*out.w;
+        const float *wt = ay.weights + (size_t)y*ay.taps;
+        float *dst = out.data + (size_t)r*out.w;
+        for (int x = 0; x < out.w; x++) dst[x] = wt[0]*src[x];
+        for (int t = 1; t < ay.taps; t++) {
+            const float *row = src + (size_t)t*out.w;
+            for (int x = 0; x < out.w; x++) dst[x] += wt[t]*row[x];
+        }
+    }
+
+    uw_arena_pop(tmp.data);
+}
+
+// Bilinear resize into an existing image, clamping at the edges. Exactly
+// half and twice the size go to the fixed weight 2x kernels.
+// image out: output, its size is the size to resize to, im.c channels.
+void bilinear_resize_into(image im, image out)
+{
+    assert(out.c == im.c);
+    if (out.w*2 == im.w && out.h*2 == im.h) {
+        downsample2x_into(im, out);
+        return;
+    }
+    if (out.w == 2*im.w && out.h == 2*im.h) {
+        upsample2x_into(im, out);
+        return;
+    }
+    resample_axis ax = make_resample_axis(im.w, out.w, RESAMPLE_BILINEAR, 0);
+    resample_axis ay = make_resample_axis(im.h, out.h, RESAMPLE_BILINEAR, 0);
+    resample_separable(im, out, ax, ay);
+    uw_arena_pop(ax.start);
+}
+
+image bilinear_resize(image im, int w, int h)
+{
+    image resized_image = make_image(w, h, im.c);
+    bilinear_resize_into(im, resized_image);
     return resized_image;
 }
 
+// Resizes with an antialiasing filter into an existing image. Shrinking
+// stretches the filter over each output pixel's footprint, so detail finer
+// than the output can hold is averaged away instead of aliasing, with no
+// separate blur pass. Enlarging interpolates with the filter as is.
+// Bicubic and Lanczos overshoot at sharp edges; the result isn't clamped.
+// image out: output, its size is the size to resize to, im.c channels.
+// resample_filter filter: RESAMPLE_AREA averages the input under each
+//                         output pixel, RESAMPLE_BILINEAR, RESAMPLE_BICUBIC
+//                         and RESAMPLE_LANCZOS3 are progressively sharper.
+void resample_image_into(image im, image out, resample_filter filter)
+{
+    assert(out.c == im.c);
+    resample_axis ax = make_resample_axis(im.w, out.w, filter, 1);
+    resample_axis ay = make_resample_axis(im.h, out.h, filter, 1);
+    resample_separable(im, out, ax, ay);
+    uw_arena_pop(ax.start);
+}
+
+image resample_image(image im, int w, int h, resample_filter filter)
+{
+    image resized_image = make_image(w, h, im.c);
+    resample_image_into(im, resized_image, filter);
+    return resized_image;
+}
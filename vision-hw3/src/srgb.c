@@ -0,0 +1,85 @@
+#include <math.h>
+#include <pthread.h>
+#include "image.h"
+
+// The sRGB transfer function. Image files hold sRGB encoded bytes; light
+// adds up linearly, so resizing and blurring are only physically right on
+// linear values. Decoding a byte is a 256 entry table. Encoding rounds
+// exactly like round(255*linear_to_srgb(x)) but without a pow per pixel:
+// a coarse table indexed by x gives a first guess at the byte, and the
+// exact byte thresholds fix it up in a step or two.
+
+// Buckets of the coarse encode table over [0, 1].
+#define SRGB_BUCKETS 4096
+
+static float srgb_thresholds[256];
+static unsigned char srgb_coarse[SRGB_BUCKETS + 1];
+// Encoders on several threads may be first at once; the tables are built
+// by exactly one of them and published to all.
+static pthread_once_t srgb_tables_once = PTHREAD_ONCE_INIT;
+
+static double srgb_to_linear_d(double v)
+{
+    return (v <= 0.04045) ? v/12.92 : pow((v + 0.055)/1.055, 2.4);
+}
+
+static double linear_to_srgb_d(double v)
+{
+    return (v <= 0.0031308) ? v*12.92 : 1.055*pow(v, 1/2.4) - 0.055;
+}
+
+// Converts an sRGB encoded value in [0, 1] to linear light.
+float srgb_to_linear(float v)
+{
+    return srgb_to_linear_d(v);
+}
+
+// Converts a linear light value in [0, 1] to sRGB encoding.
+float linear_to_srgb(float v)
+{
+    return linear_to_srgb_d(v);
+}
+
+// The byte a linear value encodes to, the slow exact way.
+static int srgb_byte(float x)
+{
+    double v = MIN(MAX(x, 0), 1);
+    return (int)floor(255*linear_to_srgb_d(v) + .5);
+}
+
+static void build_srgb_tables()
+{
+    // srgb_thresholds[k] is the smallest float that encodes to k or more.
+    srgb_thresholds[0] = 0;
+    for (int k = 1; k < 256; k++) {
+        float t = srgb_to_linear_d((k - .5)/255);
+        while (srgb_byte(t) >= k) t = nextafterf(t, -1);
+        while (srgb_byte(t) < k) t = nextafterf(t, 2);
+        srgb_thresholds[k] = t;
+    }
+    for (int i = 0; i <= SRGB_BUCKETS; i++) {
+        srgb_coarse[i] = srgb_byte((float)i/SRGB_BUCKETS);
+    }
+}
+
+// Fills the 256 entry table that decodes sRGB bytes to linear light.
+void srgb_decode_table(float *table)
+{
+    for (int i = 0; i < 256; i++) table[i] = srgb_to_linear_d(i/255.);
+}
+
+// Encodes linear light values to sRGB bytes, clamping to [0, 1].
+// const float *src: n linear values.
+// unsigned char *dst: n bytes.
+void linear_to_srgb8_row(const float *src, unsigned char *dst, int n)
+{
+    pthread_once(&srgb_tables_once, build_srgb_tables);
+    for (int i = 0; i < n; i++) {
+        float x = MIN(MAX(src[i], 0), 1);
+        // The bucket's lower edge encodes to srgb_coarse, the byte can
+        // only be that or higher.
+        int b = srgb_coarse[(int)(x*SRGB_BUCKETS)];
+        while (b < 255 && x >= srgb_thresholds[b + 1]) b++;
+        dst[i] = b;
+    }
+}
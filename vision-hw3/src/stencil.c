@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "image.h"
+#include "stencil.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STENCIL_X86
+#include <immintrin.h>
+#endif
+
+// Computes out[x] += sum of the 3x3 window around x for x in [x0, x1).
+// const float *r0, *r1, *r2: the rows above, at and below the output row.
+// const float *f: 3x3 filter, row major.
+// Every x in [x0, x1) must have x-1 and x+1 inside the rows.
+typedef void (*stencil_row_fn)(const float *r0, const float *r1, const float *r2,
+        const float *f, float *out, int x0, int x1);
+
+// Picked once, by whichever thread convolves first.
+static stencil_impl current_impl = STENCIL_NONE;
+static pthread_once_t current_impl_once = PTHREAD_ONCE_INIT;
+
+static void stencil_row_scalar(const float *r0, const float *r1, const float *r2,
+        const float *f, float *out, int x0, int x1)
+{
+    for (int x = x0; x < x1; x++) {
+        float sum = 0;
+        sum += f[0]*r0[x-1];
+        sum += f[1]*r0[x];
+        sum += f[2]*r0[x+1];
+        sum += f[3]*r1[x-1];
+        sum += f[4]*r1[x];
+        sum += f[5]*r1[x+1];
+        sum += f[6]*r2[x-1];
+        sum += f[7]*r2[x];
+        sum += f[8]*r2[x+1];
+        out[x] += sum;
+    }
+}
+
+#ifdef STENCIL_X86
+// 8 output pixels per iteration as two 4 wide vectors. Taps are added in
+// the same order as the scalar path so all implementations agree exactly.
+__attribute__((target("sse2")))
+static void stencil_row_sse(const float *r0, const float *r1, const float *r2,
+        const float *f, float *out, int x0, int x1)
+{
+    const float *rows[3] = {r0, r1, r2};
+    __m128 k[9];
+    for (int i = 0; i < 9; i++) k[i] = _mm_set1_ps(f[i]);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8) {
+        __m128 a = _mm_setzero_ps();
+        __m128 b = _mm_setzero_ps();
+        for (int fy = 0; fy < 3; fy++) {
+            const float *p = rows[fy] + x - 1;
+            for (int fx = 0; fx < 3; fx++) {
+                a = _mm_add_ps(a, _mm_mul_ps(k[fy*3 + fx], _mm_loadu_ps(p + fx)));
+                b = _mm_add_ps(b, _mm_mul_ps(k[fy*3 + fx], _mm_loadu_ps(p + fx + 4)));
+            }
+        }
+        _mm_storeu_ps(out + x, _mm_add_ps(_mm_loadu_ps(out + x), a));
+        _mm_storeu_ps(out + x + 4, _mm_add_ps(_mm_loadu_ps(out + x + 4), b));
+    }
+    stencil_row_scalar(r0, r1, r2, f, out, x, x1);
+}
+
+// 16 output pixels per iteration as two 8 wide vectors. FMA is left off
+// on purpose so results stay identical to the other implementations.
+__attribute__((target("avx2")))
+static void stencil_row_avx2(const float *r0, const float *r1, const float *r2,
+        const float *f, float *out, int x0, int x1)
+{
+    const float *rows[3] = {r0, r1, r2};
+    __m256 k[9];
+    for (int i = 0; i < 9; i++) k[i] = _mm256_set1_ps(f[i]);
+    int x = x0;
+    for (; x + 16 <= x1; x += 16) {
+        __m256 a = _mm256_setzero_ps();
+        __m256 b = _mm256_setzero_ps();
+        for (int fy = 0; fy < 3; fy++) {
+            const float *p = rows[fy] + x - 1;
+            for (int fx = 0; fx < 3; fx++) {
+                a = _mm256_add_ps(a, _mm256_mul_ps(k[fy*3 + fx], _mm256_loadu_ps(p + fx)));
+                b = _mm256_add_ps(b, _mm256_mul_ps(k[fy*3 + fx], _mm256_loadu_ps(p + fx + 8)));
+            }
+        }
+        _mm256_storeu_ps(out + x, _mm256_add_ps(_mm256_loadu_ps(out + x), a));
+        _mm256_storeu_ps(out + x + 8, _mm256_add_ps(_mm256_loadu_ps(out + x + 8), b));
+    }
+    stencil_row_sse(r0, r1, r2, f, out, x, x1);
+}
+#endif
+
+// returns: the fastest implementation this CPU supports.
+stencil_impl best_stencil_impl()
+{
+#ifdef STENCIL_X86
+    if (uw_cpu_has(UW_CPU_AVX2)) return STENCIL_AVX2;
+    if (uw_cpu_has(UW_CPU_SSE2)) return STENCIL_SSE;
+#endif
+    return STENCIL_SCALAR;
+}
+
+static void pick_stencil_impl()
+{
+    current_impl = best_stencil_impl();
+}
+
+// returns: the implementation convolve_image uses, picked on first use.
+stencil_impl get_stencil_impl()
+{
+    pthread_once(&current_impl_once, pick_stencil_impl);
+    return current_impl;
+}
+
+// Overrides the implementation, mostly for benchmarks and tests. Requests
+// for something the CPU can't run fall back to the best supported one.
+// Call it while no other thread is convolving.
+void set_stencil_impl(stencil_impl s)
+{
+    pthread_once(&current_impl_once, pick_stencil_impl);
+    stencil_impl best = best_stencil_impl();
+    current_impl = (s > best) ? best : s;
+}
+
+const char *stencil_impl_name(stencil_impl s)
+{
+    switch (s) {
+        case STENCIL_NONE: return "generic";
+        case STENCIL_SCALAR: return "scalar";
+        case STENCIL_SSE: return "sse";
+        case STENCIL_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+static stencil_row_fn stencil_row_function(stencil_impl s)
+{
+#ifdef STENCIL_X86
+    if (s == STENCIL_AVX2) return stencil_row_avx2;
+    if (s == STENCIL_SSE) return stencil_row_sse;
+#endif
+    return stencil_row_scalar;
+}
+
+// Convolves a plane with a 3x3 filter and adds the result to dst. The
+// source carries its own border, so every row, edges included, goes
+// through the selected vector kernel without any clamping.
+// const float *src: pixel (0, 0) of a w x h plane with a filled border of
+//                   at least one pixel, see pad_image.
+// int stride: floats between rows of src.
+// const float *f: 3x3 filter plane.
+// float *dst: w x h output plane, must be zeroed or hold a partial sum.
+void convolve3x3_plane(const float *src, int stride, int w, int h, const float *f, float *dst)
+{
+    stencil_row_fn row = stencil_row_function(get_stencil_impl());
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; y++) {
+        const float *r1 = src + y*stride;
+        row(r1 - stride, r1, r1 + stride, f, dst + y*w, 0, w);
+    }
+}
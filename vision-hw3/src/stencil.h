@@ -0,0 +1,15 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+// Implementations of the 3x3 stencil used by convolve_image for 3x3
+// filters. STENCIL_NONE sends 3x3 filters through the generic path.
+typedef enum{
+    STENCIL_NONE, STENCIL_SCALAR, STENCIL_SSE, STENCIL_AVX2
+} stencil_impl;
+
+stencil_impl best_stencil_impl();
+stencil_impl get_stencil_impl();
+void set_stencil_impl(stencil_impl s);
+const char *stencil_impl_name(stencil_impl s);
+void convolve3x3_plane(const float *src, int stride, int w, int h, const float *f, float *dst);
+#endif
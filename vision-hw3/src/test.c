@@ -6,6 +6,7 @@
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "stencil.h"
 
 void feature_normalize2(image im)
 {
@@ -21,6 +22,106 @@ void feature_normalize2(image im)
     }
 }
 
+// Straightforward convolution through get_pixel, used as a reference for
+// the optimized convolve_image.
+image convolve_image_reference(image im, image filter, int preserve)
+{
+    image out = make_image(im.w, im.h, preserve ? im.c : 1);
+    int ch, x, y, fx, fy;
+    for(ch = 0; ch < im.c; ++ch){
+        int fc = (filter.c == im.c) ? ch : 0;
+        for(y = 0; y < im.h; ++y){
+            for(x = 0; x < im.w; ++x){
+                float sum = 0;
+                for(fy = 0; fy < filter.h; ++fy){
+                    for(fx = 0; fx < filter.w; ++fx){
+                        sum += get_pixel(filter, fx, fy, fc) *
+                            get_pixel(im, x + fx - filter.w/2, y + fy - filter.h/2, ch);
+                    }
+                }
+                out.data[(preserve ? ch : 0)*im.w*im.h + y*im.w + x] += sum;
+            }
+        }
+    }
+    return out;
+}
+
+// Pixel at a time rgb_to_hsv, the reference for the vectorized one.
+void rgb_to_hsv_reference(image im)
+{
+    int x, y;
+    for(y = 0; y < im.h; ++y){
+        for(x = 0; x < im.w; ++x){
+            float r = get_pixel(im, x, y, 0);
+            float g = get_pixel(im, x, y, 1);
+            float b = get_pixel(im, x, y, 2);
+            float v = MAX(MAX(r, g), b);
+            float m = MIN(MIN(r, g), b);
+            float c = v - m;
+            float s = 0;
+            if(v > 0) s = c / v;
+            float h_ = 0;
+            if(c != 0){
+                if(v == r) h_ = (g - b) / c;
+                if(v == g) h_ = (b - r) / c + 2;
+                if(v == b) h_ = (r - g) / c + 4;
+            }
+            float h = h_ / 6;
+            if(h_ < 0) h = h_ / 6 + 1;
+            set_pixel(im, x, y, 0, h);
+            set_pixel(im, x, y, 1, s);
+            set_pixel(im, x, y, 2, v);
+        }
+    }
+}
+
+// Pixel at a time hsv_to_rgb, the reference for the vectorized one.
+void hsv_to_rgb_reference(image im)
+{
+    int x, y;
+    for(y = 0; y < im.h; ++y){
+        for(x = 0; x < im.w; ++x){
+            float h = get_pixel(im, x, y, 0);
+            float s = get_pixel(im, x, y, 1);
+            float v = get_pixel(im, x, y, 2);
+            float i = trunc(h * 6);
+            float f = (h * 6) - i;
+            float p = v * (1 - s);
+            float q = v * (1 - s * f);
+            float t = v * (1 - s * (1 - f));
+            float r = 0, g = 0, b = 0;
+            if(i == 0){ r = v; g = t; b = p; }
+            if(i == 1){ r = q; g = v; b = p; }
+            if(i == 2){ r = p; g = v; b = t; }
+            if(i == 3){ r = p; g = q; b = v; }
+            if(i == 4){ r = t; g = p; b = v; }
+            if(i == 5){ r = v; g = p; b = q; }
+            set_pixel(im, x, y, 0, r);
+            set_pixel(im, x, y, 1, g);
+            set_pixel(im, x, y, 2, b);
+        }
+    }
+}
+
+float max_abs_diff(image a, image b)
+{
+    float max = 0;
+    int i;
+    for(i = 0; i < a.w*a.h*a.c; ++i){
+        float d = fabsf(a.data[i] - b.data[i]);
+        if(d > max || d != d) max = (d != d) ? INFINITY : d;
+    }
+    return max;
+}
+
+image make_random_image(int w, int h, int c)
+{
+    image im = make_image(w, h, c);
+    int i;
+    for(i = 0; i < w*h*c; ++i) im.data[i] = (float)rand()/RAND_MAX;
+    return im;
+}
+
 int tests_total = 0;
 int tests_fail = 0;
 
@@ -132,6 +233,53 @@ void test_hsv_to_rgb()
     free_image(c);
 }
 
+void test_hsv_exhaustive()
+{
+    // Every 8 bit RGB color, 256 blue levels of a 256 x 256 red/green
+    // image, through both directions against the pixel at a time code.
+    // Only float rounding may differ, a few ulps at most.
+    image rgb = make_image(256, 256, 3);
+    float hsv_err = 0, rgb_err = 0;
+    int r, g, b;
+    for(b = 0; b < 256; ++b){
+        for(g = 0; g < 256; ++g){
+            for(r = 0; r < 256; ++r){
+                set_pixel(rgb, r, g, 0, r/255.);
+                set_pixel(rgb, r, g, 1, g/255.);
+                set_pixel(rgb, r, g, 2, b/255.);
+            }
+        }
+        image fast = copy_image(rgb);
+        image ref = copy_image(rgb);
+        rgb_to_hsv(fast);
+        rgb_to_hsv_reference(ref);
+        hsv_err = MAX(hsv_err, max_abs_diff(fast, ref));
+        hsv_to_rgb(fast);
+        hsv_to_rgb_reference(ref);
+        rgb_err = MAX(rgb_err, max_abs_diff(fast, ref));
+        free_image(fast);
+        free_image(ref);
+    }
+    TEST(hsv_err < 1e-5);
+    TEST(rgb_err < 1e-5);
+    free_image(rgb);
+
+    // Hues far out of range come out black instead of overflowing the
+    // sector index.
+    float hues[] = {1e30, -1e30, 6.5, -2, 1};
+    image far = make_image(5, 1, 3);
+    for(r = 0; r < 5; ++r){
+        set_pixel(far, r, 0, 0, hues[r]);
+        set_pixel(far, r, 0, 1, .5);
+        set_pixel(far, r, 0, 2, .8);
+    }
+    hsv_to_rgb(far);
+    float far_max = 0;
+    for(r = 0; r < far.w*far.h*far.c; ++r) far_max = MAX(far_max, fabsf(far.data[r]));
+    TEST(far_max == 0);
+    free_image(far);
+}
+
 void test_nn_resize()
 {
     image im = load_image("data/dogsmall.jpg");
@@ -188,6 +336,813 @@ void test_multiple_resize()
 }
 
 
+// Clamped bilinear resize, done the slow way.
+image bilinear_reference(image im, int w, int h)
+{
+    int x, y, k;
+    image ref = make_image(w, h, im.c);
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < h; ++y){
+            float sy = MIN(MAX((y + .5f)*im.h/h - .5f, 0), im.h - 1);
+            int y0 = sy;
+            for(x = 0; x < w; ++x){
+                float sx = MIN(MAX((x + .5f)*im.w/w - .5f, 0), im.w - 1);
+                int x0 = sx;
+                float fx = sx - x0, fy = sy - y0;
+                float top = get_pixel(im, x0, y0, k)*(1-fx) + get_pixel(im, x0+1, y0, k)*fx;
+                float bot = get_pixel(im, x0, y0+1, k)*(1-fx) + get_pixel(im, x0+1, y0+1, k)*fx;
+                set_pixel(ref, x, y, k, top*(1-fy) + bot*fy);
+            }
+        }
+    }
+    return ref;
+}
+
+// 1 if every sample of an 8 bit image is within steps of 255 * b.
+int close_u8(image_u8 a, image b, int steps)
+{
+    int i;
+    if(a.w != b.w || a.h != b.h || a.c != b.c) return 0;
+    for(i = 0; i < a.w*a.h*a.c; ++i){
+        if(fabsf(a.data[i] - 255*b.data[i]) > steps + .01) return 0;
+    }
+    return 1;
+}
+
+void test_image_u8()
+{
+    image im = load_image("data/dog.jpg");
+    image_u8 u = load_image_u8("data/dog.jpg");
+    TEST(close_u8(u, im, 0));
+    image_u8 v = image_to_u8(im);
+    TEST(memcmp(u.data, v.data, u.w*u.h*u.c) == 0);
+    image back = u8_to_image(u);
+    TEST(same_image(back, im));
+
+    image gray = rgb_to_grayscale(im);
+    image_u8 gray_u8 = rgb_to_grayscale_u8(u);
+    TEST(close_u8(gray_u8, gray, 1));
+
+    image nn = load_image("figs/dog-resize-nn.png");
+    image_u8 nn_u8 = nn_resize_u8(u, 713, 467);
+    TEST(close_u8(nn_u8, nn, 0));
+
+    int sizes[][2] = {{713, 467}, {97, 61}, {2000, 1500}};
+    int i;
+    for(i = 0; i < 3; ++i){
+        int w = sizes[i][0], h = sizes[i][1];
+        image ref = bilinear_reference(im, w, h);
+        image_u8 bl = bilinear_resize_u8(u, w, h);
+        TEST(close_u8(bl, ref, 2));
+        free_image(ref);
+        free_image_u8(bl);
+    }
+
+    int windows[] = {1, 4, 7, 30};
+    for(i = 0; i < 4; ++i){
+        image box = box_filter_image(back, windows[i]);
+        image_u8 box_u8 = box_blur_u8(u, windows[i]);
+        TEST(close_u8(box_u8, box, 1));
+        free_image(box);
+        free_image_u8(box_u8);
+    }
+
+    // Saturating arithmetic never wraps.
+    image_u8 a = make_image_u8(4, 1, 1), b = make_image_u8(4, 1, 1);
+    unsigned char av[] = {0, 100, 200, 255}, bv[] = {10, 100, 100, 255};
+    memcpy(a.data, av, 4);
+    memcpy(b.data, bv, 4);
+    image_u8 sum = add_image_u8(a, b), diff = sub_image_u8(a, b);
+    unsigned char sumv[] = {10, 200, 255, 255}, diffv[] = {0, 0, 100, 0};
+    TEST(memcmp(sum.data, sumv, 4) == 0);
+    TEST(memcmp(diff.data, diffv, 4) == 0);
+    scale_image_u8(a, 0, 1.5);
+    unsigned char scaledv[] = {0, 150, 255, 255};
+    TEST(memcmp(a.data, scaledv, 4) == 0);
+
+    free_image_u8(a); free_image_u8(b); free_image_u8(sum); free_image_u8(diff);
+    free_image(nn); free_image_u8(nn_u8);
+    free_image(gray); free_image_u8(gray_u8);
+    free_image(back);
+    free_image_u8(v);
+    free_image_u8(u);
+    free_image(im);
+}
+
+void test_image_f16()
+{
+    // Every half survives the round trip, and the row converters, F16C
+    // where the CPU has it, agree with the software ones bit for bit.
+    int i, n = 1 << 16, bad = 0;
+    unsigned short *h = malloc(n*sizeof(unsigned short));
+    unsigned short *h2 = malloc(n*sizeof(unsigned short));
+    float *f = malloc(n*sizeof(float));
+    for(i = 0; i < n; ++i) h[i] = i;
+    f16_to_float_row(h, f, n);
+    float_to_f16_row(f, h2, n);
+    for(i = 0; i < n; ++i){
+        float g = half_to_float(i);
+        if((i & 0x7c00) == 0x7c00 && (i & 0x3ff)) continue;
+        if(memcmp(&g, f + i, sizeof(float)) || h2[i] != i || float_to_half(g) != i) ++bad;
+    }
+    TEST(bad == 0);
+
+    // Rounding is to nearest, ties to even, in and below the normal range.
+    TEST(float_to_half(1) == 0x3c00);
+    TEST(float_to_half(1 + 1/2048.) == 0x3c00);
+    TEST(float_to_half(1 + 3/2048.) == 0x3c02);
+    TEST(float_to_half(65504) == 0x7bff);
+    TEST(float_to_half(65520) == 0x7c00);
+    TEST(float_to_half(-ldexpf(1, -24)) == 0x8001);
+    TEST(float_to_half(ldexpf(1, -25)) == 0);
+    TEST(float_to_half(ldexpf(1.5, -24)) == 2);
+
+    image im = load_image("data/dog.jpg");
+    bad = 0;
+    for(i = 0; i < n; ++i) f[i] = (im.data[i] - .5f)*ldexpf(1, i%40 - 20);
+    float_to_f16_row(f, h, n);
+    for(i = 0; i < n; ++i) bad += h[i] != float_to_half(f[i]);
+    TEST(bad == 0);
+    free(h); free(h2); free(f);
+
+    image_f16 im16 = image_to_f16(im);
+    image back = f16_to_image(im16);
+    TEST(same_image(back, im));
+
+    // Operators compute in float, so against the float operator on the
+    // same samples the only error left is rounding the output.
+    // The random filter doesn't factor and takes the FFT path.
+    image filters[] = {make_gaussian_filter(2), make_highpass_filter(), make_box_filter(11),
+        make_random_image(16, 16, 1)};
+    int preserve[] = {1, 0, 1, 1};
+    l1_normalize(filters[3]);
+    TEST(convolve_image_uses_fft(back, filters[3]));
+    for(i = 0; i < 4; ++i){
+        image ref = convolve_image(back, filters[i], preserve[i]);
+        image_f16 c = convolve_image_f16(im16, filters[i], preserve[i]);
+        image cf = f16_to_image(c);
+        TEST(same_image(cf, ref));
+        free_image(ref); free_image(cf); free_image_f16(c); free_image(filters[i]);
+    }
+
+    // Each smoothing mode against its float counterpart, on both sides
+    // of SMOOTH_IIR_MIN_SIGMA, and the default against smooth_image.
+    float sigmas[] = {2, 8};
+    smooth_mode modes[] = {SMOOTH_FIR, SMOOTH_IIR, SMOOTH_AUTO};
+    int m;
+    for(i = 0; i < 2; ++i){
+        for(m = 0; m < 3; ++m){
+            image ref = smooth_image_mode(back, sigmas[i], modes[m]);
+            image_f16 s = smooth_image_mode_f16(im16, sigmas[i], modes[m]);
+            image sf = f16_to_image(s);
+            TEST(same_image(sf, ref));
+            free_image(ref); free_image(sf); free_image_f16(s);
+        }
+        image ref = smooth_image(back, sigmas[i]);
+        image_f16 s = smooth_image_f16(im16, sigmas[i]);
+        image sf = f16_to_image(s);
+        TEST(same_image(sf, ref));
+        free_image(ref); free_image(sf); free_image_f16(s);
+    }
+
+    int sizes[][2] = {{713, 467}, {97, 61}};
+    for(i = 0; i < 2; ++i){
+        image ref = bilinear_reference(back, sizes[i][0], sizes[i][1]);
+        image_f16 r = bilinear_resize_f16(im16, sizes[i][0], sizes[i][1]);
+        image rf = f16_to_image(r);
+        TEST(same_image(rf, ref));
+        free_image(ref); free_image(rf); free_image_f16(r);
+    }
+
+    free_image(back);
+    free_image_f16(im16);
+    free_image(im);
+}
+
+void test_interleave()
+{
+    // The shuffle kernels against the obvious loops, with lengths that
+    // leave every possible tail.
+    int lens[] = {1, 15, 16, 17, 100, 1001};
+    int i, j, k, c, bad = 0;
+    unsigned char *src = malloc(4*1001), *planes = malloc(4*1001), *back = malloc(4*1001);
+    for(i = 0; i < 4*1001; ++i) src[i] = (i*37 + 11) & 255;
+    for(c = 1; c <= 4; ++c){
+        for(j = 0; j < 6; ++j){
+            int n = lens[j];
+            deinterleave_u8(src, n, c, planes, 1001);
+            for(k = 0; k < c; ++k){
+                for(i = 0; i < n; ++i) bad += planes[k*1001 + i] != src[i*c + k];
+            }
+            interleave_u8(planes, 1001, n, c, back);
+            bad += memcmp(back, src, n*c) != 0;
+        }
+    }
+    TEST(bad == 0);
+    free(src); free(planes); free(back);
+
+    // Interleaved images hold the same pixels and every kernel that takes
+    // them agrees with the planar one.
+    image_u8 p = load_image_u8("data/dog.jpg");
+    image_u8 q = load_image_u8_layout("data/dog.jpg", LAYOUT_INTERLEAVED);
+    TEST(q.layout == LAYOUT_INTERLEAVED);
+    image_u8 qp = convert_layout_u8(q, LAYOUT_PLANAR);
+    TEST(memcmp(qp.data, p.data, p.w*p.h*p.c) == 0);
+    image pf = u8_to_image(p), qf = u8_to_image(q);
+    TEST(same_image(pf, qf));
+
+    image_u8 pr = nn_resize_u8(p, 301, 199), qr = nn_resize_u8(q, 301, 199);
+    image_u8 qrp = convert_layout_u8(qr, LAYOUT_PLANAR);
+    TEST(memcmp(qrp.data, pr.data, 301*199*3) == 0);
+    free_image_u8(pr); free_image_u8(qr); free_image_u8(qrp);
+
+    pr = bilinear_resize_u8(p, 1000, 700), qr = bilinear_resize_u8(q, 1000, 700);
+    qrp = convert_layout_u8(qr, LAYOUT_PLANAR);
+    TEST(memcmp(qrp.data, pr.data, 1000*700*3) == 0);
+    free_image_u8(pr); free_image_u8(qr); free_image_u8(qrp);
+
+    pr = rgb_to_grayscale_u8(p), qr = rgb_to_grayscale_u8(q);
+    TEST(memcmp(qr.data, pr.data, p.w*p.h) == 0);
+    free_image_u8(pr); free_image_u8(qr);
+
+    scale_image_u8(p, 1, 1.3);
+    scale_image_u8(q, 1, 1.3);
+    free_image_u8(qp);
+    qp = convert_layout_u8(q, LAYOUT_PLANAR);
+    TEST(memcmp(qp.data, p.data, p.w*p.h*p.c) == 0);
+
+    // Saved without reordering, read back the same.
+    save_png_u8(q, "data/interleaved_test");
+    image_u8 r = load_image_u8("data/interleaved_test.png");
+    TEST(memcmp(r.data, p.data, p.w*p.h*p.c) == 0);
+    free_image_u8(r);
+    remove("data/interleaved_test.png");
+
+    free_image(pf); free_image(qf);
+    free_image_u8(p); free_image_u8(q); free_image_u8(qp);
+}
+
+void test_pointwise()
+{
+    image im = load_image("data/dog.jpg");
+    image f = make_gaussian_filter(2);
+    image blur = convolve_image(im, f, 1);
+    image sharp = sub_image(im, blur);
+
+    // A color correction done one pass at a time...
+    image ref = copy_image(im);
+    shift_image(ref, 0, .1);
+    scale_image(ref, 1, 1.3);
+    image added = add_image(ref, sharp);
+    shift_image(added, 2, -.05);
+    image subbed = sub_image(added, blur);
+    scale_image(subbed, 0, 2);
+    shift_image(subbed, 0, .4);
+    clamp_image(subbed);
+
+    // ...and fused.
+    pointwise_expr e = pointwise_begin();
+    pointwise_shift(&e, 0, .1);
+    pointwise_scale(&e, 1, 1.3);
+    pointwise_add(&e, sharp);
+    pointwise_shift(&e, 2, -.05);
+    pointwise_sub(&e, blur);
+    pointwise_scale(&e, 0, 2);
+    pointwise_shift(&e, 0, .4);
+    pointwise_clamp(&e);
+    image out = make_image(im.w, im.h, im.c);
+    pointwise_apply_into(&e, im, out);
+    TEST(same_image(out, subbed));
+    pointwise_apply(&e, im);
+    TEST(same_image(im, subbed));
+
+    // An operand may be the image being written.
+    pointwise_expr z = pointwise_begin();
+    pointwise_sub(&z, out);
+    pointwise_apply(&z, out);
+    int i, bad = 0;
+    for(i = 0; i < out.w*out.h*out.c; ++i) bad += out.data[i] != 0;
+    TEST(bad == 0);
+
+    free_image(f); free_image(blur); free_image(sharp); free_image(ref);
+    free_image(added); free_image(subbed); free_image(out); free_image(im);
+}
+
+void test_reductions()
+{
+    image im = load_image("data/dog.jpg");
+    size_t n = (size_t)im.w*im.h*im.c, i;
+    double sum = 0, sq = 0;
+    float lo = im.data[0], hi = im.data[0];
+    for(i = 0; i < n; ++i){
+        sum += im.data[i];
+        lo = MIN(lo, im.data[i]);
+        hi = MAX(hi, im.data[i]);
+    }
+    double mean = sum/n;
+    for(i = 0; i < n; ++i) sq += (im.data[i] - mean)*(im.data[i] - mean);
+
+    // Split the work before taking the values the thread count check
+    // below compares against.
+    int threads = uw_get_num_threads();
+    uw_set_num_threads(2);
+    double s = reduce_sum(im.data, n);
+    TEST(fabs(s - sum) < 1e-6*sum);
+    float rlo, rhi;
+    reduce_min_max(im.data, n, &rlo, &rhi);
+    TEST(rlo == lo && rhi == hi);
+    double m, v;
+    reduce_mean_variance(im.data, n, &m, &v);
+    TEST(fabs(m - mean) < 1e-6 && fabs(v - sq/n) < 1e-6*sq/n);
+
+    // A large offset moves the mean and leaves the variance alone.
+    image off = copy_image(im);
+    shift_image(off, 0, 1000); shift_image(off, 1, 1000); shift_image(off, 2, 1000);
+    double m2, v2;
+    reduce_mean_variance(off.data, n, &m2, &v2);
+    TEST(fabs(m2 - mean - 1000) < 1e-3 && fabs(v2 - sq/n) < 1e-3*sq/n);
+
+    int counts[10], ref[10] = {0}, total = 0, k;
+    for(i = 0; i < n; ++i){
+        k = (int)(im.data[i]*10);
+        ref[MIN(MAX(k, 0), 9)]++;
+    }
+    reduce_histogram(im.data, n, 10, 0, 1, counts);
+    int bad = 0;
+    for(k = 0; k < 10; ++k){
+        bad += counts[k] != ref[k];
+        total += counts[k];
+    }
+    TEST(bad == 0 && total == (int)n);
+
+    // Same answers whatever the thread count.
+    uw_set_num_threads(3);
+    double m3, v3;
+    reduce_mean_variance(im.data, n, &m3, &v3);
+    TEST(reduce_sum(im.data, n) == s && m3 == m && v3 == v);
+    uw_set_num_threads(threads);
+
+    // feature_normalize maps the real extremes to 0 and 1, even when
+    // every value is above 1.
+    feature_normalize(off);
+    reduce_min_max(off.data, n, &rlo, &rhi);
+    TEST(within_eps(rlo, 0) && within_eps(rhi, 1));
+
+    free_image(off);
+    free_image(im);
+}
+
+// A saturation boost, a nonlinear color transform.
+static void saturate_transform(image im, void *arg)
+{
+    rgb_to_hsv(im);
+    scale_image(im, 1, *(float *)arg);
+    clamp_image(im);
+    hsv_to_rgb(im);
+}
+
+// An affine color mix, which trilinear interpolation reproduces exactly.
+void mix_transform(image im, void *arg)
+{
+    int i, size = im.w*im.h;
+    for(i = 0; i < size; ++i){
+        float r = im.data[i], g = im.data[size + i], b = im.data[2*size + i];
+        im.data[i] = .8*r + .2*g;
+        im.data[size + i] = .1*r + .7*g + .2*b + .05;
+        im.data[2*size + i] = .9*b;
+    }
+}
+
+void test_color_lut()
+{
+    image im = load_image("data/dog.jpg");
+
+    // Identity and affine tables give back the transform exactly.
+    color_lut id = make_color_lut(17, 0, 0);
+    image a = copy_image(im);
+    apply_color_lut(a, id);
+    TEST(same_image(a, im));
+    free_image(a);
+
+    color_lut mix = make_color_lut(5, mix_transform, 0);
+    a = copy_image(im);
+    image b = copy_image(im);
+    apply_color_lut(a, mix);
+    mix_transform(b, 0);
+    TEST(same_image(a, b));
+    free_image(a); free_image(b);
+
+    // A nonlinear chain comes out close to running the chain itself.
+    float factor = 2;
+    color_lut sat = make_color_lut(33, saturate_transform, &factor);
+    a = copy_image(im);
+    b = copy_image(im);
+    apply_color_lut(a, sat);
+    saturate_transform(b, &factor);
+    int i, n = im.w*im.h*im.c;
+    double total = 0;
+    for(i = 0; i < n; ++i) total += fabs(a.data[i] - b.data[i]);
+    TEST(total/n < .003);
+
+    // A saved table reads back bit for bit.
+    TEST(save_color_lut(sat, "data/lut_test.cube"));
+    color_lut back = load_color_lut("data/lut_test.cube");
+    remove("data/lut_test.cube");
+    TEST(back.n == sat.n && memcmp(back.data, sat.data, 3*33*33*33*sizeof(float)) == 0);
+    color_lut missing = load_color_lut("data/no_such_lut.cube");
+    TEST(missing.n == 0 && missing.data == 0);
+
+    free_color_lut(id); free_color_lut(mix); free_color_lut(sat); free_color_lut(back);
+    free_image(a); free_image(b); free_image(im);
+}
+
+void test_srgb()
+{
+    // The decode table is the transfer function at every byte.
+    float table[256];
+    srgb_decode_table(table);
+    int i, bad = 0;
+    for(i = 0; i < 256; ++i) bad += !within_eps(table[i], srgb_to_linear(i/255.));
+    TEST(bad == 0);
+    TEST(within_eps(linear_to_srgb(srgb_to_linear(.5)), .5));
+
+    // The table encoder rounds to the nearest byte, including right at the
+    // byte boundaries and outside [0, 1]. Exactly at a boundary the float
+    // formula can't tell the two bytes apart, so either is accepted.
+    int n = 1 << 16;
+    float *x = calloc(n + 256*3, sizeof(float));
+    unsigned char *enc = calloc(n + 256*3, 1);
+    for(i = 0; i < n; ++i) x[i] = (float)i/(n - 1);
+    for(i = 0; i < 256; ++i){
+        float t = srgb_to_linear((i + .5)/255.);
+        x[n + 3*i] = nextafterf(t, -1);
+        x[n + 3*i + 1] = t;
+        x[n + 3*i + 2] = nextafterf(t, 2);
+    }
+    x[0] = -1; x[n - 1] = 2;
+    int m = n + 256*3;
+    linear_to_srgb8_row(x, enc, m);
+    bad = 0;
+    for(i = 0; i < m; ++i){
+        float v = MIN(MAX(x[i], 0), 1);
+        bad += fabs(enc[i] - 255*linear_to_srgb(v)) > .5001;
+    }
+    TEST(bad == 0);
+    free(x); free(enc);
+
+    // Loading linear is decoding the plain load, and saving linear then
+    // loading linear gives back the same bytes.
+    image im = load_image("data/dog.jpg");
+    image lin = load_image_linear("data/dog.jpg");
+    image ref = copy_image(im);
+    for(i = 0; i < ref.w*ref.h*ref.c; ++i) ref.data[i] = srgb_to_linear(ref.data[i]);
+    TEST(same_image(lin, ref));
+    save_png_linear(lin, "data/srgb_test");
+    image back = load_image_linear("data/srgb_test.png");
+    image raw = load_image("data/srgb_test.png");
+    remove("data/srgb_test.png");
+    TEST(same_image(back, lin));
+    TEST(same_image(raw, im));
+    free_image(im); free_image(lin); free_image(ref); free_image(back); free_image(raw);
+}
+
+void test_histogram()
+{
+    image im = load_image("data/dog.jpg");
+    int bins = 64, i, k;
+    int *counts = calloc(im.c*bins, sizeof(int));
+    int *naive = calloc(im.c*bins, sizeof(int));
+    image_histogram(im, bins, counts);
+    for(k = 0; k < im.c; ++k){
+        for(i = 0; i < im.w*im.h; ++i){
+            int b = im.data[k*im.w*im.h + i]*bins;
+            naive[k*bins + MIN(MAX(b, 0), bins - 1)]++;
+        }
+    }
+    TEST(memcmp(counts, naive, im.c*bins*sizeof(int)) == 0);
+
+    // Equalizing keeps the order of values, stretches them to [0, 1], and
+    // leaves a near flat histogram. Other channels are untouched.
+    image eq = copy_image(im);
+    equalize_image(eq, 1, 256);
+    int order = 1, n = im.w*im.h;
+    float *before = im.data + n, *after = eq.data + n;
+    for(i = 1; i < n; ++i){
+        if((before[i] < before[i-1] && after[i] > after[i-1]) ||
+           (before[i] > before[i-1] && after[i] < after[i-1])) order = 0;
+    }
+    TEST(order);
+    float lo, hi;
+    reduce_min_max(after, n, &lo, &hi);
+    TEST(within_eps(lo, 0) && within_eps(hi, 1));
+    reduce_histogram(after, n, 4, 0, 1, counts);
+    for(k = 0; k < 4; ++k) TEST(fabs(counts[k] - n/4.) < .05*n);
+    TEST(memcmp(eq.data, im.data, n*sizeof(float)) == 0);
+    TEST(memcmp(eq.data + 2*n, im.data + 2*n, n*sizeof(float)) == 0);
+
+    // CLAHE with one tile and no clipping is global equalization.
+    image cl = copy_image(im);
+    equalize_image(eq, -1, 256);
+    clahe_image(cl, -1, 1, 256, 0);
+    TEST(same_image(cl, eq));
+
+    // Tiled and clipped it stays in range and leaves a flat image flat,
+    // near its level: clipping spreads some counts to empty bins.
+    free_image(cl);
+    cl = copy_image(im);
+    clahe_image(cl, -1, 8, 256, 3);
+    reduce_min_max(cl.data, cl.w*cl.h*cl.c, &lo, &hi);
+    TEST(lo >= 0 && hi <= 1);
+    image flat = make_image(64, 48, 1);
+    for(i = 0; i < flat.w*flat.h; ++i) flat.data[i] = .5;
+    clahe_image(flat, 0, 4, 256, 3);
+    reduce_min_max(flat.data, flat.w*flat.h, &lo, &hi);
+    TEST(within_eps(lo, hi) && fabs(lo - .5) < .02);
+
+    free(counts); free(naive);
+    free_image(im); free_image(eq); free_image(cl); free_image(flat);
+}
+
+void test_resample()
+{
+    image im = load_image("data/dog.jpg");
+    resample_filter filters[] = {RESAMPLE_BILINEAR, RESAMPLE_AREA, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3};
+    int f, i, x, y, k;
+
+    // Every filter interpolates, so the same size gives the image back.
+    for(f = 0; f < 4; ++f){
+        image same = resample_image(im, im.w, im.h, filters[f]);
+        TEST(same_image(same, im));
+        free_image(same);
+    }
+
+    // Shrinking by a whole factor with the area filter averages blocks.
+    image area = resample_image(im, im.w/4, im.h/4, RESAMPLE_AREA);
+    image blocks = make_image(im.w/4, im.h/4, im.c);
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < blocks.h; ++y){
+            for(x = 0; x < blocks.w; ++x){
+                float sum = 0;
+                for(i = 0; i < 16; ++i) sum += get_pixel(im, 4*x + i%4, 4*y + i/4, k);
+                set_pixel(blocks, x, y, k, sum/16);
+            }
+        }
+    }
+    TEST(same_image(area, blocks));
+
+    // A one pixel checkerboard is too fine for a quarter size image; the
+    // antialiased filters average it to gray where bilinear aliases.
+    image check = make_image(203, 161, 1);
+    for(y = 0; y < check.h; ++y){
+        for(x = 0; x < check.w; ++x) set_pixel(check, x, y, 0, (x + y)%2);
+    }
+    for(f = 1; f < 4; ++f){
+        image small = resample_image(check, 50, 40, filters[f]);
+        float lo, hi;
+        reduce_min_max(small.data, small.w*small.h, &lo, &hi);
+        TEST(lo > .45 && hi < .55);
+        free_image(small);
+    }
+    image aliased = bilinear_resize(check, 50, 40);
+    float lo, hi;
+    reduce_min_max(aliased.data, aliased.w*aliased.h, &lo, &hi);
+    TEST(hi - lo > .5);
+
+    // Cached tables give the same result on a second call.
+    image again = resample_image(im, im.w/4, im.h/4, RESAMPLE_AREA);
+    TEST(memcmp(again.data, area.data, area.w*area.h*area.c*sizeof(float)) == 0);
+
+    free_image(im); free_image(area); free_image(blocks); free_image(check);
+    free_image(aliased); free_image(again);
+}
+
+// Blurs with [1 4 6 4 1]/16 and keeps the even samples, the slow way.
+image reduce_reference(image im)
+{
+    float w[5] = {1, 4, 6, 4, 1};
+    int x, y, k, i, j;
+    image out = make_image((im.w + 1)/2, (im.h + 1)/2, im.c);
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < out.h; ++y){
+            for(x = 0; x < out.w; ++x){
+                float sum = 0;
+                for(j = 0; j < 5; ++j){
+                    for(i = 0; i < 5; ++i){
+                        sum += w[i]*w[j]*get_pixel(im, 2*x + i - 2, 2*y + j - 2, k);
+                    }
+                }
+                set_pixel(out, x, y, k, sum/256);
+            }
+        }
+    }
+    return out;
+}
+
+void test_pyramid()
+{
+    image im = load_image("data/dogsmall.jpg");
+    pyramid p = make_pyramid(im, 20);
+    int i, n = 0;
+
+    // Levels halve, rounding up, down to a single pixel, all in one block.
+    TEST(pyramid_level(p, p.levels - 1).w == 1 && pyramid_level(p, p.levels - 1).h == 1);
+    for(i = 0; i + 1 < p.levels; ++i){
+        image a = pyramid_level(p, i), b = pyramid_level(p, i + 1);
+        if(b.w != (a.w + 1)/2 || b.h != (a.h + 1)/2) n++;
+        if(b.data != a.data + a.w*a.h*a.c) n++;
+    }
+    TEST(n == 0);
+    TEST(same_image(pyramid_level(p, 0), im));
+
+    // Each level is the blurred, decimated level below.
+    for(i = 0; i < 3; ++i){
+        image ref = reduce_reference(pyramid_level(p, i));
+        TEST(same_image(pyramid_level(p, i + 1), ref));
+        free_image(ref);
+    }
+
+    // Rebuilding after a new frame matches building from scratch.
+    image next = load_image("data/dogsmall.jpg");
+    scale_image(next, 0, .5);
+    copy_image_into(next, pyramid_level(p, 0));
+    rebuild_pyramid(p, 0);
+    pyramid fresh = make_pyramid(next, 20);
+    n = 0;
+    for(i = 0; i < p.levels; ++i) n += !same_image(pyramid_level(p, i), pyramid_level(fresh, i));
+    TEST(n == 0);
+
+    // A Laplacian pyramid holds detail, near zero on average, and collapses
+    // back to the image.
+    laplacian_pyramid(&p);
+    image detail = pyramid_level(p, 0);
+    TEST(fabs(reduce_sum(detail.data, detail.w*detail.h*detail.c)) < .01*detail.w*detail.h*detail.c);
+    TEST(same_image(pyramid_level(p, p.levels - 1), pyramid_level(fresh, p.levels - 1)));
+    collapse_pyramid(&p);
+    n = 0;
+    for(i = 0; i < p.levels; ++i) n += !same_image(pyramid_level(p, i), pyramid_level(fresh, i));
+    TEST(n == 0);
+
+    free_pyramid(p); free_pyramid(fresh);
+    free_image(im); free_image(next);
+}
+
+void test_remap()
+{
+    image im = load_image("data/dogsmall.jpg");
+    int x, y, k, i, n;
+
+    // The identity homography gives the image back.
+    matrix I = make_identity_homography();
+    image same = remap_image(im, homography_warp(I, im.w, im.h, 0, 0));
+    TEST(same_image(same, im));
+
+    // A whole pixel shift moves pixels and leaves 0 where there is no source.
+    matrix T = make_translation_homography(5, -3);
+    image moved = remap_image(im, homography_warp(T, im.w, im.h, 0, 0));
+    n = 0;
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < im.h; ++y){
+            for(x = 0; x < im.w; ++x){
+                int sx = x + 5, sy = y - 3;
+                float want = (sx < im.w && sy >= 0) ? get_pixel(im, sx, sy, k) : 0;
+                n += !within_eps(get_pixel(moved, x, y, k), want);
+            }
+        }
+    }
+    TEST(n == 0);
+
+    // A stored map samples like bilinear_interpolate.
+    warp m = make_remap(64, 48);
+    for(i = 0; i < m.w*m.h; ++i){
+        m.x[i] = (i*37 % 1000)/1000.*(im.w - 1);
+        m.y[i] = (i*91 % 1000)/1000.*(im.h - 1);
+    }
+    image sampled = remap_image(im, m);
+    n = 0;
+    for(k = 0; k < im.c; ++k){
+        for(i = 0; i < m.w*m.h; ++i){
+            float want = bilinear_interpolate(im, m.x[i], m.y[i], k);
+            n += !within_eps(sampled.data[k*m.w*m.h + i], want);
+        }
+    }
+    TEST(n == 0);
+
+    // Baked warps match the generated ones.
+    matrix H = make_translation_homography(2.5, 1.25);
+    H.data[2][0] = .0005;
+    warp gen[2] = {homography_warp(H, 150, 100, -10, 20), cylinder_warp(im.w, im.h, 300)};
+    for(i = 0; i < 2; ++i){
+        warp baked = bake_warp(gen[i]);
+        image a = remap_image(im, gen[i]);
+        image b = remap_image(im, baked);
+        TEST(same_image(a, b));
+        free_image(a); free_image(b); free_warp(baked);
+    }
+
+    // The cylinder keeps the center column.
+    image cyl = cylindrical_project(im, 300);
+    n = 0;
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < im.h; ++y) n += !within_eps(get_pixel(cyl, im.w/2, y, k), get_pixel(im, im.w/2, y, k));
+    }
+    TEST(n == 0);
+
+    free_matrix(I); free_matrix(T); free_matrix(H); free_warp(m);
+    free_image(im); free_image(same); free_image(moved); free_image(sampled); free_image(cyl);
+}
+
+void test_resize2x()
+{
+    // Odd sizes and widths that aren't a multiple of the vector width
+    // exercise the edges and the scalar tails.
+    int sizes[3][2] = {{128, 96}, {75, 43}, {3, 2}};
+    int i, x, y, k, n;
+    image dog = load_image("data/dog.jpg");
+    for(i = 0; i < 3; ++i){
+        int w = sizes[i][0], h = sizes[i][1];
+        image im = bilinear_resize(dog, w, h);
+
+        // Halving averages 2 x 2 blocks, dropping an odd last column/row.
+        image half = downsample2x(im);
+        n = 0;
+        for(k = 0; k < im.c; ++k){
+            for(y = 0; y < half.h; ++y){
+                for(x = 0; x < half.w; ++x){
+                    float v = (get_pixel(im, 2*x, 2*y, k) + get_pixel(im, 2*x+1, 2*y, k) +
+                               get_pixel(im, 2*x, 2*y+1, k) + get_pixel(im, 2*x+1, 2*y+1, k))/4;
+                    n += !within_eps(get_pixel(half, x, y, k), v);
+                }
+            }
+        }
+        TEST(n == 0);
+
+        // Doubling is bilinear resize to twice the size.
+        image twice = upsample2x(im);
+        image ref = bilinear_reference(im, 2*w, 2*h);
+        TEST(same_image(twice, ref));
+
+        // Nearest neighbor picks the same pixels as the general path.
+        image nn = nn_resize(im, 2*w, 2*h);
+        image nn_ref = make_image(2*w, 2*h, im.c);
+        for(k = 0; k < im.c; ++k){
+            for(y = 0; y < nn_ref.h; ++y){
+                for(x = 0; x < nn_ref.w; ++x){
+                    set_pixel(nn_ref, x, y, k, nn_interpolate(im, .5*x - .25, .5*y - .25, k));
+                }
+            }
+        }
+        TEST(same_image(nn, nn_ref));
+
+        // And at half the size, which for even sizes picks the odd samples
+        // without going through nn_interpolate.
+        image nh = nn_resize(im, w/2, h/2);
+        image nh_ref = make_image(w/2, h/2, im.c);
+        float ax = (float)w/(w/2), ay = (float)h/(h/2);
+        for(k = 0; k < im.c; ++k){
+            for(y = 0; y < nh_ref.h; ++y){
+                for(x = 0; x < nh_ref.w; ++x){
+                    set_pixel(nh_ref, x, y, k, nn_interpolate(im, ax*x - .5 + .5*ax, ay*y - .5 + .5*ay, k));
+                }
+            }
+        }
+        TEST(same_image(nh, nh_ref));
+
+        // 8 bit halving and doubling, in both layouts.
+        image_u8 u = image_to_u8(im);
+        image back = u8_to_image(u);
+        image_u8 ul = convert_layout_u8(u, LAYOUT_INTERLEAVED);
+        if(w%2 == 0 && h%2 == 0){
+            image href = bilinear_reference(back, w/2, h/2);
+            image_u8 uh = downsample2x_u8(u);
+            image_u8 uhi = downsample2x_u8(ul);
+            image_u8 uhl = convert_layout_u8(uhi, LAYOUT_PLANAR);
+            TEST(close_u8(uh, href, 1));
+            TEST(close_u8(uhl, href, 1));
+            free_image(href); free_image_u8(uh); free_image_u8(uhi); free_image_u8(uhl);
+        }
+        image tref = bilinear_reference(back, 2*w, 2*h);
+        image_u8 ut = upsample2x_u8(u);
+        image_u8 uti = upsample2x_u8(ul);
+        image_u8 utl = convert_layout_u8(uti, LAYOUT_PLANAR);
+        TEST(close_u8(ut, tref, 1));
+        TEST(close_u8(utl, tref, 1));
+        // Doubling rounds exactly like the general 8 bit path.
+        image_u8 gt = bilinear_resize_u8_general(u, 2*w, 2*h);
+        image_u8 gti = bilinear_resize_u8_general(ul, 2*w, 2*h);
+        size_t bytes = (size_t)4*w*h*im.c;
+        TEST(!memcmp(ut.data, gt.data, bytes));
+        TEST(!memcmp(uti.data, gti.data, bytes));
+        free_image_u8(gt); free_image_u8(gti);
+
+        free_image(im); free_image(half); free_image(twice); free_image(ref);
+        free_image(nn); free_image(nn_ref); free_image(nh); free_image(nh_ref);
+        free_image(back); free_image(tref);
+        free_image_u8(u); free_image_u8(ul); free_image_u8(ut); free_image_u8(uti);
+        free_image_u8(utl);
+    }
+    free_image(dog);
+}
+
 void test_highpass_filter(){
     image im = load_image("data/dog.jpg");
     image f = make_highpass_filter();
@@ -233,6 +1188,156 @@ void test_sharpen_filter(){
     free_image(gt);
 }
 
+void test_convolve_border(){
+    // Odd and even filter sizes, including filters larger than the image,
+    // so every pixel of the small image exercises the clamped border path.
+    int sizes[][2] = {{3,3}, {7,7}, {4,6}, {1,9}, {9,1}, {40,3}, {25,25}};
+    image im = make_random_image(37, 23, 3);
+    int i, preserve;
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i){
+        image f = make_random_image(sizes[i][0], sizes[i][1], 1);
+        for(preserve = 0; preserve < 2; ++preserve){
+            image a = convolve_image(im, f, preserve);
+            image b = convolve_image_reference(im, f, preserve);
+            TEST(same_image(a, b));
+            free_image(a);
+            free_image(b);
+        }
+        free_image(f);
+    }
+    free_image(im);
+}
+
+void test_convolve_separable(){
+    // Separable filters take the two pass path and must agree with the
+    // direct 2d convolution.
+    image im = make_random_image(61, 47, 3);
+    image filters[4];
+    filters[0] = make_box_filter(7);
+    filters[1] = make_gaussian_filter(4);
+    filters[2] = make_gaussian_filter(1.5);
+    filters[3] = make_box_filter(5);
+    int i, preserve;
+    for(i = 0; i < 4; ++i){
+        for(preserve = 0; preserve < 2; ++preserve){
+            image a = convolve_image(im, filters[i], preserve);
+            image b = convolve_image_reference(im, filters[i], preserve);
+            TEST(same_image(a, b));
+            free_image(a);
+            free_image(b);
+        }
+        free_image(filters[i]);
+    }
+    free_image(im);
+}
+
+void test_convolve_fft(){
+    // Random filters don't factor, so big ones take the FFT path inside
+    // convolve_image as well as being called directly here.
+    int sizes[][2] = {{3,3}, {16,16}, {31,17}, {60,5}};
+    image im = make_random_image(97, 54, 3);
+    int i, preserve;
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i){
+        image f = make_random_image(sizes[i][0], sizes[i][1], 1);
+        l1_normalize(f);
+        for(preserve = 0; preserve < 2; ++preserve){
+            image a = convolve_image_fft(im, f, preserve);
+            image b = convolve_image(im, f, preserve);
+            image c = convolve_image_reference(im, f, preserve);
+            TEST(same_image(a, c));
+            TEST(same_image(b, c));
+            free_image(a);
+            free_image(b);
+            free_image(c);
+        }
+        free_image(f);
+    }
+
+    // Unnormalized filters scale the output and its rounding error with
+    // their L1 norm, so the FFT path is held to EPS relative to it.
+    image f = make_random_image(16, 16, 1);
+    float norm = 0;
+    for(i = 0; i < f.w*f.h; ++i) norm += fabsf(f.data[i]);
+    for(preserve = 0; preserve < 2; ++preserve){
+        image a = convolve_image(im, f, preserve);
+        image b = convolve_image_reference(im, f, preserve);
+        float worst = 0;
+        for(int j = 0; j < a.w*a.h*a.c; ++j) worst = MAX(worst, fabsf(a.data[j] - b.data[j]));
+        TEST(worst < EPS*norm);
+        free_image(a);
+        free_image(b);
+    }
+    free_image(f);
+    free_image(im);
+}
+
+void test_stencil(){
+    // Every 3x3 implementation, including images too thin for the
+    // interior path, against the get_pixel reference.
+    int sizes[][2] = {{37,23}, {64,5}, {2,9}, {1,1}, {19,2}};
+    stencil_impl best = best_stencil_impl();
+    stencil_impl saved = get_stencil_impl();
+    image f = make_random_image(3, 3, 1);
+    int i, s, preserve;
+    for(s = STENCIL_NONE; s <= best; ++s){
+        set_stencil_impl(s);
+        for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i){
+            image im = make_random_image(sizes[i][0], sizes[i][1], 3);
+            for(preserve = 0; preserve < 2; ++preserve){
+                image a = convolve_image(im, f, preserve);
+                image b = convolve_image_reference(im, f, preserve);
+                TEST(same_image(a, b));
+                free_image(a);
+                free_image(b);
+            }
+            free_image(im);
+        }
+    }
+    set_stencil_impl(saved);
+    free_image(f);
+}
+
+void test_padded_image(){
+    // Every border mode, including borders wider than the image, against
+    // the index arithmetic written out by hand.
+    int sizes[][3] = {{23, 17, 5}, {3, 2, 7}, {1, 4, 2}};
+    border_mode modes[] = {BORDER_CLAMP, BORDER_REFLECT, BORDER_ZERO};
+    int i, m, x, y, c;
+    for(i = 0; i < 3; ++i){
+        int w = sizes[i][0], h = sizes[i][1], pad = sizes[i][2];
+        image im = make_random_image(w, h, 2);
+        for(m = 0; m < 3; ++m){
+            padded_image p = pad_image(im, pad, modes[m]);
+            int ok = 1;
+            for(c = 0; c < p.c; ++c){
+                for(y = -pad; y < h + pad; ++y){
+                    if((size_t)(p.data + c*p.plane + y*p.stride) % 64) ok = 0;
+                    for(x = -pad; x < w + pad; ++x){
+                        int sx = x, sy = y;
+                        float expected;
+                        if(modes[m] == BORDER_REFLECT){
+                            while(sx < 0 || sx >= w) sx = (w == 1) ? 0 : (sx < 0 ? -sx : 2*(w-1) - sx);
+                            while(sy < 0 || sy >= h) sy = (h == 1) ? 0 : (sy < 0 ? -sy : 2*(h-1) - sy);
+                        }
+                        if(modes[m] == BORDER_ZERO && (x < 0 || x >= w || y < 0 || y >= h)){
+                            expected = 0;
+                        } else {
+                            expected = get_pixel(im, sx, sy, c);
+                        }
+                        if(p.data[c*p.plane + y*p.stride + x] != expected) ok = 0;
+                    }
+                }
+            }
+            TEST(ok);
+            image back = unpad_image(p);
+            TEST(same_image(back, im));
+            free_image(back);
+            free_padded_image(p);
+        }
+        free_image(im);
+    }
+}
+
 void test_convolution(){
     image im = load_image("data/dog.jpg");
     image f = make_box_filter(7);
@@ -358,6 +1463,87 @@ void test_sobel(){
     free(res);
 }
 
+void test_threads()
+{
+    // Parallel kernels must give the same bits for any thread count.
+    image im = load_image("data/dog.jpg");
+    image f = make_gaussian_filter(2);
+    image out[2][5];
+    int t, i;
+    int nthreads = uw_get_num_threads();
+    for(t = 0; t < 2; ++t){
+        uw_set_num_threads(t ? 4 : 1);
+        out[t][0] = convolve_image(im, f, 1);
+        out[t][1] = bilinear_resize(im, 301, 199);
+        out[t][2] = copy_image(im);
+        rgb_to_hsv(out[t][2]);
+        out[t][3] = structure_matrix(im, 2);
+        out[t][4] = cornerness_response(out[t][3]);
+    }
+    uw_set_num_threads(nthreads);
+    for(i = 0; i < 5; ++i){
+        image a = out[0][i];
+        image b = out[1][i];
+        TEST(a.w == b.w && a.h == b.h && a.c == b.c &&
+             0 == memcmp(a.data, b.data, a.w*a.h*a.c*sizeof(float)));
+        free_image(a);
+        free_image(b);
+    }
+    free_image(im);
+    free_image(f);
+}
+
+void test_sobel_magnitude(){
+    image im = load_image("data/dog.jpg");
+    image *res = sobel_image(im);
+    image mag = sobel_magnitude(im);
+    TEST(same_image(mag, res[0]));
+    free_image(im);
+    free_image(mag);
+    free_image(res[0]);
+    free_image(res[1]);
+    free(res);
+}
+
+void test_smooth_iir()
+{
+    // Young - van Vliet is a third order approximation with slightly heavy
+    // tails. From SMOOTH_IIR_MIN_SIGMA up it stays within 2.5% of the image
+    // range of the FIR path at the worst edge pixel and 0.3% on average. A
+    // constant image must come back unchanged, which checks the edges.
+    image im = load_image("data/dog.jpg");
+    float sigmas[] = {SMOOTH_IIR_MIN_SIGMA, 8, 16, 32};
+    int i, j;
+    for(i = 0; i < 4; ++i){
+        image fir = smooth_image_mode(im, sigmas[i], SMOOTH_FIR);
+        image iir = smooth_image_mode(im, sigmas[i], SMOOTH_IIR);
+        float max = 0;
+        double mean = 0;
+        for(j = 0; j < im.w*im.h*im.c; ++j){
+            float d = fabsf(fir.data[j] - iir.data[j]);
+            if(d > max) max = d;
+            mean += d;
+        }
+        mean /= im.w*im.h*im.c;
+        TEST(max < .025);
+        TEST(mean < .003);
+        // smooth_image stays FIR at every sigma; the IIR path is opt-in.
+        image plain = smooth_image(im, sigmas[i]);
+        TEST(!memcmp(plain.data, fir.data, im.w*im.h*im.c*sizeof(float)));
+        free_image(plain);
+        free_image(fir);
+        free_image(iir);
+    }
+
+    image flat = make_image(45, 31, 2);
+    for(j = 0; j < flat.w*flat.h*flat.c; ++j) flat.data[j] = .7;
+    image s = smooth_image_iir(flat, 6);
+    TEST(same_image(s, flat));
+    free_image(flat);
+    free_image(s);
+    free_image(im);
+}
+
 void test_structure()
 {
     image im = load_image("data/dogbw.png");
@@ -365,6 +1551,23 @@ void test_structure()
     feature_normalize2(s);
     image gt = load_image("figs/structure.png");
     TEST(same_image(s, gt));
+
+    // Large windows still weight with the direct Gaussian, like
+    // smooth_image, not the recursive approximation.
+    image gx = make_gx_filter(), gy = make_gy_filter();
+    image ix = convolve_image(im, gx, 0), iy = convolve_image(im, gy, 0);
+    image p = make_image(im.w, im.h, 3);
+    int i, size = im.w*im.h;
+    for(i = 0; i < size; ++i){
+        p.data[i] = ix.data[i]*ix.data[i];
+        p.data[i + size] = iy.data[i]*iy.data[i];
+        p.data[i + 2*size] = ix.data[i]*iy.data[i];
+    }
+    image ref = smooth_image(p, 6);
+    image big = structure_matrix(im, 6);
+    TEST(same_image(big, ref));
+    free_image(gx); free_image(gy); free_image(ix); free_image(iy);
+    free_image(p); free_image(ref); free_image(big);
     free_image(im);
     free_image(s);
     free_image(gt);
@@ -384,6 +1587,240 @@ void test_cornerness()
     free_image(gt);
 }
 
+void test_integral_image()
+{
+    image im = make_random_image(37, 29, 2);
+    image integ = make_integral_image(im);
+    int x, y, c, i, j;
+    int ok = 1;
+    for(c = 0; c < im.c; ++c){
+        for(y = 0; y < im.h; ++y){
+            for(x = 0; x < im.w; ++x){
+                double sum = 0;
+                for(j = 0; j <= y; ++j){
+                    for(i = 0; i <= x; ++i) sum += get_pixel(im, i, j, c);
+                }
+                if(fabs(sum - get_pixel(integ, x, y, c)) > 1e-3) ok = 0;
+            }
+        }
+    }
+    TEST(ok);
+
+    // Windows partly or entirely off the image, with and without padding.
+    int windows[][4] = {{3,4,10,12}, {-5,-2,6,8}, {30,20,50,40}, {-10,-10,60,50}, {5,5,5,9}};
+    int pads[] = {0, 12};
+    int p, w;
+    for(p = 0; p < 2; ++p){
+        summed_area_table t = make_summed_area_table(im, pads[p]);
+        ok = 1;
+        for(w = 0; w < 5; ++w){
+            int *r = windows[w];
+            for(c = 0; c < im.c; ++c){
+                double sum = 0;
+                for(j = MAX(r[1], -pads[p]); j < MIN(r[3], im.h + pads[p]); ++j){
+                    for(i = MAX(r[0], -pads[p]); i < MIN(r[2], im.w + pads[p]); ++i){
+                        sum += get_pixel(im, i, j, c);
+                    }
+                }
+                if(fabs(sum - window_sum(t, r[0], r[1], r[2], r[3], c)) > 1e-6) ok = 0;
+            }
+        }
+        TEST(ok);
+        free_summed_area_table(t);
+    }
+    free_image(integ);
+    free_image(im);
+}
+
+void test_box_filter()
+{
+    // Any window size costs the same and must match a clamped convolution
+    // with a box filter, including windows wider than the image. Big box
+    // filters given to convolve_image take the same path.
+    image im = make_random_image(53, 41, 3);
+    int sizes[] = {1, 2, 5, 8, 31, 90};
+    int i;
+    for(i = 0; i < 6; ++i){
+        image f = make_box_filter(sizes[i]);
+        image a = box_filter_image(im, sizes[i]);
+        image b = convolve_image_reference(im, f, 1);
+        TEST(same_image(a, b));
+        image c = convolve_image(im, f, 0);
+        image d = convolve_image_reference(im, f, 0);
+        TEST(same_image(c, d));
+        free_image(a);
+        free_image(b);
+        free_image(c);
+        free_image(d);
+        free_image(f);
+    }
+    free_image(im);
+}
+
+void test_optical_flow()
+{
+    // A smooth image moved two pixels right has flow pointing right.
+    image base = load_image("data/dogsmall.jpg");
+    image prev = smooth_image(base, 2);
+    image im = make_image(prev.w, prev.h, prev.c);
+    int i, j, k;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < im.h; ++j){
+            for(i = 0; i < im.w; ++i){
+                set_pixel(im, i, j, k, get_pixel(prev, i - 2, j, k));
+            }
+        }
+    }
+    image v = optical_flow_images(im, prev, 7, 4);
+    double vx = 0, vy = 0;
+    for(i = 0; i < v.w*v.h; ++i){
+        vx += v.data[i];
+        vy += v.data[i + v.w*v.h];
+    }
+    vx /= v.w*v.h;
+    vy /= v.w*v.h;
+    // Sobel gradients are 8 times the pixel difference, so 2 pixels of
+    // motion come out near .25.
+    TEST(vx > .15 && vx < .35);
+    TEST(fabs(vy) < vx/4);
+    free_image(v);
+    free_image(im);
+    free_image(prev);
+    free_image(base);
+}
+
+void test_arena()
+{
+    // Blocks are aligned and popping returns everything above them.
+    char *a = uw_arena_push(10);
+    char *b = uw_arena_push(3 << 20);
+    char *c = uw_arena_push(100);
+    TEST((size_t)a % 64 == 0 && (size_t)b % 64 == 0 && (size_t)c % 64 == 0);
+    memset(b, 1, 3 << 20);
+    uw_arena_pop(b);
+    TEST(uw_arena_push(1) == b);
+    uw_arena_pop(a);
+
+    // Once warmed up, repeated multi-stage operators stop allocating
+    // scratch memory.
+    image im = load_image("data/dogsmall.jpg");
+    image prev = load_image("data/dog_a.jpg");
+    image prev_small = bilinear_resize(prev, im.w, im.h);
+    int i, n;
+    size_t allocations = 0;
+    for(i = 0; i < 4; ++i){
+        if(i == 2) allocations = uw_arena_allocations();
+        image s = structure_matrix(im, 2);
+        image g = smooth_image_mode(im, 6, SMOOTH_AUTO);
+        descriptor *d = harris_corner_detector(im, 2, 50, 3, &n);
+        image v = optical_flow_images(im, prev_small, 5, 4);
+        free_image(s);
+        free_image(g);
+        free_descriptors(d, n);
+        free_image(v);
+    }
+    TEST(uw_arena_allocations() == allocations);
+    free_image(im);
+    free_image(prev);
+    free_image(prev_small);
+}
+
+// An image of the given shape full of garbage, to check that _into
+// variants write every pixel rather than relying on a zeroed output.
+image dirty_image(int w, int h, int c)
+{
+    image im = make_image(w, h, c);
+    int i;
+    for(i = 0; i < w*h*c; ++i) im.data[i] = 7;
+    return im;
+}
+
+void test_into()
+{
+    image im = load_image("data/dogsmall.jpg");
+    image gray = rgb_to_grayscale(im);
+    image f = make_gaussian_filter(2);
+    image hp = make_highpass_filter();
+    image big = make_image(15, 15, 1);
+    int i;
+    for(i = 0; i < 15*15; ++i) big.data[i] = (i%7) - 3;
+
+    image ref = convolve_image(im, f, 1);
+    image out = dirty_image(im.w, im.h, im.c);
+    convolve_image_into(im, f, 1, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    ref = convolve_image_fft(im, big, 0);
+    out = dirty_image(im.w, im.h, 1);
+    convolve_image_fft_into(im, big, 0, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    ref = nn_resize(im, 301, 199);
+    out = dirty_image(301, 199, im.c);
+    nn_resize_into(im, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    ref = bilinear_resize(im, 301, 199);
+    out = dirty_image(301, 199, im.c);
+    bilinear_resize_into(im, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    // Resizing covers any number of channels, not just three.
+    image gray_small = nn_resize(gray, 50, 40);
+    image small_rgb = nn_resize(im, 50, 40);
+    image small_gray = rgb_to_grayscale(small_rgb);
+    TEST(same_image(gray_small, small_gray));
+    free_image(gray_small); free_image(small_rgb); free_image(small_gray);
+
+    image blurred = convolve_image(im, hp, 1);
+    ref = add_image(im, blurred);
+    out = dirty_image(im.w, im.h, im.c);
+    add_image_into(im, blurred, out);
+    TEST(same_image(out, ref));
+    image diff = sub_image(ref, blurred);
+    TEST(same_image(diff, im));
+    // In place, the output aliasing an input.
+    sub_image_into(out, blurred, out);
+    TEST(same_image(out, im));
+    free_image(ref); free_image(out); free_image(diff); free_image(blurred);
+
+    ref = sobel_magnitude(im);
+    out = dirty_image(im.w, im.h, 1);
+    sobel_magnitude_into(im, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    ref = colorize_sobel(im);
+    out = dirty_image(im.w, im.h, 3);
+    colorize_sobel_into(im, out);
+    TEST(same_image(out, ref));
+    free_image(ref); free_image(out);
+
+    // A frame loop of resize, grayscale and blur that reuses its buffers.
+    image small = make_image(im.w/2, im.h/2, 3);
+    small_gray = make_image(im.w/2, im.h/2, 1);
+    image smooth = make_image(im.w/2, im.h/2, 1);
+    for(i = 0; i < 3; ++i){
+        bilinear_resize_into(im, small);
+        rgb_to_grayscale_into(small, small_gray);
+        smooth_image_into(small_gray, 2, smooth);
+    }
+    image r = bilinear_resize(im, im.w/2, im.h/2);
+    image g = rgb_to_grayscale(r);
+    image s = smooth_image(g, 2);
+    TEST(same_image(smooth, s));
+    free_image(r); free_image(g); free_image(s);
+    free_image(small); free_image(small_gray); free_image(smooth);
+
+    free_image(f); free_image(hp); free_image(big);
+    free_image(gray);
+    free_image(im);
+}
+
 void run_tests()
 {
     //test_matrix();
@@ -394,20 +1831,46 @@ void run_tests()
     test_grayscale();
     test_rgb_to_hsv();
     test_hsv_to_rgb();
+    test_hsv_exhaustive();
     test_nn_resize();
     test_bl_resize();
     test_multiple_resize();
+    test_image_u8();
+    test_image_f16();
+    test_interleave();
+    test_pointwise();
+    test_reductions();
+    test_color_lut();
+    test_srgb();
+    test_histogram();
+    test_resample();
+    test_pyramid();
+    test_remap();
+    test_resize2x();
     test_gaussian_filter();
     test_sharpen_filter();
     test_emboss_filter();
     test_highpass_filter();
     test_convolution();
+    test_convolve_border();
+    test_convolve_separable();
+    test_convolve_fft();
+    test_padded_image();
+    test_stencil();
     test_gaussian_blur();
     test_hybrid_image();
     test_frequency_image();
     test_sobel();
+    test_sobel_magnitude();
+    test_threads();
+    test_smooth_iir();
     test_structure();
     test_cornerness();
+    test_integral_image();
+    test_arena();
+    test_into();
+    test_box_filter();
+    test_optical_flow();
     printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
 }
 
@@ -1,6 +1,7 @@
 #ifndef TEST_H
 #define TEST_H
 #include <stdio.h>
+#include "image.h"
 #define EPS .005
 extern int tests_total;
 extern int tests_fail;
@@ -9,4 +10,10 @@ extern int tests_fail;
     ++tests_fail; }} while (0)
 
 void run_tests();
+void run_benchmarks();
+void rgb_to_hsv_reference(image im);
+void hsv_to_rgb_reference(image im);
+// Internal to image_u8.c, declared here so tests can reach the general
+// path behind bilinear_resize_u8's 2x shortcuts.
+image_u8 bilinear_resize_u8_general(image_u8 im, int w, int h);
 #endif
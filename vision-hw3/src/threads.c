@@ -0,0 +1,26 @@
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+// Sets the number of threads used by the parallel image kernels. Kernels
+// split work by rows or channels without shared accumulators, so results
+// don't depend on the count. Has no effect unless built with OPENMP=1.
+// int n: number of threads, or 0 to use every processor.
+void uw_set_num_threads(int n)
+{
+#ifdef _OPENMP
+    if (n < 1) n = omp_get_num_procs();
+    omp_set_num_threads(n);
+#endif
+}
+
+// returns: number of threads the next parallel kernel will use.
+int uw_get_num_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
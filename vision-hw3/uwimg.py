@@ -29,6 +29,14 @@ class DESCRIPTOR(Structure):
                 ("n", c_int),
                 ("data", POINTER(c_float))]
 
+uw_set_num_threads = lib.uw_set_num_threads
+uw_set_num_threads.argtypes = [c_int]
+uw_set_num_threads.restype = None
+
+uw_get_num_threads = lib.uw_get_num_threads
+uw_get_num_threads.argtypes = []
+uw_get_num_threads.restype = c_int
+
 add_image = lib.add_image
 add_image.argtypes = [IMAGE, IMAGE]
 add_image.restype = IMAGE
@@ -153,6 +161,10 @@ convolve_image = lib.convolve_image
 convolve_image.argtypes = [IMAGE, IMAGE, c_int]
 convolve_image.restype = IMAGE
 
+convolve_image_fft = lib.convolve_image_fft
+convolve_image_fft.argtypes = [IMAGE, IMAGE, c_int]
+convolve_image_fft.restype = IMAGE
+
 harris_corner_detector = lib.harris_corner_detector
 harris_corner_detector.argtypes = [IMAGE, c_float, c_float, c_int, POINTER(c_int)]
 harris_corner_detector.restype = POINTER(DESCRIPTOR)
@@ -185,6 +197,22 @@ draw_flow = lib.draw_flow
 draw_flow.argtypes = [IMAGE, IMAGE, c_float]
 draw_flow.restype = None
 
+image_histogram_lib = lib.image_histogram
+image_histogram_lib.argtypes = [IMAGE, c_int, POINTER(c_int)]
+image_histogram_lib.restype = None
+
+equalize_image_lib = lib.equalize_image
+equalize_image_lib.argtypes = [IMAGE, c_int, c_int]
+equalize_image_lib.restype = None
+
+clahe_image_lib = lib.clahe_image
+clahe_image_lib.argtypes = [IMAGE, c_int, c_int, c_int, c_float]
+clahe_image_lib.restype = None
+
+make_integral_image = lib.make_integral_image
+make_integral_image.argtypes = [IMAGE]
+make_integral_image.restype = IMAGE
+
 box_filter_image = lib.box_filter_image
 box_filter_image.argtypes = [IMAGE, c_int]
 box_filter_image.restype = IMAGE
@@ -200,6 +228,17 @@ optical_flow_webcam.restype = None
 def panorama_image(a, b, sigma=2, thresh=5, nms=3, inlier_thresh=2, iters=10000, cutoff=30):
     return panorama_image_lib(a, b, sigma, thresh, nms, inlier_thresh, iters, cutoff)
 
+def image_histogram(im, bins=256):
+    counts = (c_int*(im.c*bins))()
+    image_histogram_lib(im, bins, counts)
+    return [counts[k*bins:(k+1)*bins] for k in range(im.c)]
+
+def equalize_image(im, c=-1, bins=256):
+    equalize_image_lib(im, c, bins)
+
+def clahe_image(im, c=-1, tiles=8, bins=256, clip=3):
+    clahe_image_lib(im, c, tiles, bins, clip)
+
 if __name__ == "__main__":
     im = load_image("data/dog.jpg")
     save_image(im, "hey")